@@ -0,0 +1,88 @@
+#include "AnnotatedRoles.h"
+
+#include "CalleeRoles.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+namespace ota {
+
+namespace {
+
+struct RoleAnnotation {
+    StringRef Name;
+    uint32_t Roles;
+};
+
+const RoleAnnotation RoleAnnotations[] = {
+    {"ota_install", RoleInstall},
+    {"ota_verify", RoleVerify},
+    {"ota_trusted_source", RoleTrustedSource},
+    {"ota_sensitive_logging", RoleSensitiveLogging},
+    {"ota_weak_crypto", RoleWeakCrypto},
+    {"ota_erase_slot", RoleEraseSlot},
+    {"ota_write_slot", RoleWriteSlot},
+    {"ota_banned", RoleBanned},
+};
+
+// The annotation string of one llvm.global.annotations element: a pointer,
+// possibly behind a cast or GEP, to a constant C string.
+StringRef annotationText(const Constant *C) {
+    auto *GV = dyn_cast<GlobalVariable>(C->stripPointerCasts());
+    if (!GV || !GV->hasInitializer()) {
+        return {};
+    }
+    auto *Data = dyn_cast<ConstantDataSequential>(GV->getInitializer());
+    if (!Data || !Data->isCString()) {
+        return {};
+    }
+    return Data->getAsCString();
+}
+
+} // namespace
+
+Expected<AnnotatedRoles> AnnotatedRoles::parse(const Module &M) {
+    AnnotatedRoles Result;
+    const GlobalVariable *Table = M.getNamedGlobal("llvm.global.annotations");
+    if (!Table || !Table->hasInitializer()) {
+        return Result;
+    }
+
+    auto *Elements = dyn_cast<ConstantArray>(Table->getInitializer());
+    if (!Elements) {
+        return Result;
+    }
+
+    for (const Use &Op : Elements->operands()) {
+        auto *Element = dyn_cast<ConstantStruct>(Op.get());
+        if (!Element || Element->getNumOperands() < 2) {
+            continue;
+        }
+        auto *F = dyn_cast<Function>(Element->getOperand(0)->stripPointerCasts());
+        StringRef Text = annotationText(Element->getOperand(1));
+        if (!F || !Text.startswith("ota_")) {
+            continue;
+        }
+
+        if (Text == "ota_entry") {
+            Result.Entries.insert(F);
+            continue;
+        }
+
+        const RoleAnnotation *Known = llvm::find_if(
+            RoleAnnotations, [&](const RoleAnnotation &A) { return A.Name == Text; });
+        if (Known == std::end(RoleAnnotations)) {
+            return createStringError(inconvertibleErrorCode(),
+                                     "unknown annotation '%s' on %s()", Text.str().c_str(),
+                                     F->getName().str().c_str());
+        }
+        Result.Roles[F] |= Known->Roles;
+    }
+    return Result;
+}
+
+} // namespace ota
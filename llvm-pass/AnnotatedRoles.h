@@ -0,0 +1,42 @@
+#ifndef OTA_ANNOTATED_ROLES_H
+#define OTA_ANNOTATED_ROLES_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/Error.h"
+
+#include <cstdint>
+
+namespace llvm {
+class Function;
+class Module;
+} // namespace llvm
+
+namespace ota {
+
+// Entry points and callee roles declared in source, e.g.
+//
+//   __attribute__((annotate("ota_entry"))) int handleUpdate(const char *pkg);
+//   __attribute__((annotate("ota_verify"))) int checkVendorSig(const char *pkg);
+//
+// Clang records these in llvm.global.annotations; parse() reads that table
+// once, after which every query is a pointer lookup. Recognized annotations
+// are ota_entry plus one per role: ota_install, ota_verify,
+// ota_trusted_source, ota_sensitive_logging, ota_weak_crypto, ota_erase_slot,
+// ota_write_slot and ota_banned.
+class AnnotatedRoles {
+public:
+    // Fails on an "ota_" annotation that is not one of the above.
+    static llvm::Expected<AnnotatedRoles> parse(const llvm::Module &M);
+
+    uint32_t rolesOf(const llvm::Function &F) const { return Roles.lookup(&F); }
+    bool isEntry(const llvm::Function &F) const { return Entries.count(&F); }
+
+private:
+    llvm::DenseMap<const llvm::Function *, uint32_t> Roles;
+    llvm::SmallPtrSet<const llvm::Function *, 8> Entries;
+};
+
+} // namespace ota
+
+#endif
@@ -0,0 +1,228 @@
+#include "BannedApiList.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <deque>
+
+using namespace llvm;
+
+namespace ota {
+
+namespace {
+
+uint64_t gotoKey(uint32_t S, unsigned char C) {
+    return (static_cast<uint64_t>(S) << 8) | C;
+}
+
+} // namespace
+
+Expected<std::unique_ptr<BannedApiList>> BannedApiList::loadFromFile(StringRef Path) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer = MemoryBuffer::getFile(Path);
+    if (!Buffer) {
+        return createStringError(Buffer.getError(), "cannot read banned API list '%s': %s",
+                                 Path.str().c_str(), Buffer.getError().message().c_str());
+    }
+
+    auto List = std::make_unique<BannedApiList>();
+    SmallVector<StringRef, 0> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n');
+    for (StringRef Line : Lines) {
+        Line = Line.trim();
+        if (Line.empty() || Line.startswith("#")) {
+            continue;
+        }
+        List->add(Line);
+    }
+    List->finalize();
+    return List;
+}
+
+void BannedApiList::add(StringRef Entry) {
+    Entry = Entry.trim();
+    if (Entry.empty()) {
+        return;
+    }
+
+    unsigned EntryIdx = Entries.size();
+    Entries.push_back(Entry.str());
+
+    if (!Entry.contains('*')) {
+        ExactNames.try_emplace(Entry, EntryIdx);
+        return;
+    }
+
+    SmallVector<StringRef, 4> Segments;
+    Entry.split(Segments, '*', -1, false);
+    if (Segments.empty()) {
+        if (MatchAllEntry < 0) {
+            MatchAllEntry = EntryIdx;
+        }
+        return;
+    }
+
+    bool AnchoredStart = !Entry.startswith("*");
+    bool AnchoredEnd = !Entry.endswith("*");
+
+    if (Segments.size() == 1) {
+        PatternKind Kind = PatternKind::Substring;
+        if (AnchoredStart) {
+            Kind = PatternKind::Prefix;
+        } else if (AnchoredEnd) {
+            Kind = PatternKind::Suffix;
+        }
+        addKey(Segments.front(), {EntryIdx, Kind, static_cast<unsigned>(Segments.front().size())});
+        return;
+    }
+
+    // A general pattern puts each of its literals into the automaton; match()
+    // chains their hits in order.
+    for (unsigned Idx = 0, E = Segments.size(); Idx != E; ++Idx) {
+        Pattern P{EntryIdx, PatternKind::General, static_cast<unsigned>(Segments[Idx].size())};
+        P.Segment = Idx;
+        P.Last = Idx + 1 == E;
+        P.AnchoredStart = Idx == 0 && AnchoredStart;
+        P.AnchoredEnd = P.Last && AnchoredEnd;
+        addKey(Segments[Idx], P);
+    }
+}
+
+void BannedApiList::addKey(StringRef Key, const Pattern &P) {
+    if (States.empty()) {
+        States.emplace_back();
+    }
+
+    uint32_t S = 0;
+    for (char C : Key) {
+        auto Inserted = Goto.try_emplace(gotoKey(S, C), States.size());
+        if (Inserted.second) {
+            States.emplace_back();
+        }
+        S = Inserted.first->second;
+    }
+
+    States[S].Patterns.push_back(Patterns.size());
+    Patterns.push_back(P);
+}
+
+void BannedApiList::finalize() {
+    if (States.empty()) {
+        return;
+    }
+
+    // Breadth-first over the trie so every failure target is final before it
+    // is used. Children are recovered from the goto table once.
+    std::vector<SmallVector<std::pair<unsigned char, uint32_t>, 2>> Children(States.size());
+    for (const auto &Edge : Goto) {
+        Children[Edge.first >> 8].push_back({static_cast<unsigned char>(Edge.first & 0xff), Edge.second});
+    }
+
+    std::deque<uint32_t> Queue;
+    for (const auto &Child : Children[0]) {
+        States[Child.second].Fail = 0;
+        Queue.push_back(Child.second);
+    }
+
+    while (!Queue.empty()) {
+        uint32_t S = Queue.front();
+        Queue.pop_front();
+
+        for (const auto &Child : Children[S]) {
+            uint32_t F = States[S].Fail;
+            uint32_t Target = 0;
+            while (true) {
+                auto It = Goto.find(gotoKey(F, Child.first));
+                if (It != Goto.end()) {
+                    Target = It->second;
+                    break;
+                }
+                if (F == 0) {
+                    break;
+                }
+                F = States[F].Fail;
+            }
+
+            State &T = States[Child.second];
+            T.Fail = Target;
+            T.OutputLink = States[Target].Patterns.empty() ? States[Target].OutputLink : Target;
+            Queue.push_back(Child.second);
+        }
+    }
+}
+
+uint32_t BannedApiList::next(uint32_t S, unsigned char C) const {
+    while (true) {
+        auto It = Goto.find(gotoKey(S, C));
+        if (It != Goto.end()) {
+            return It->second;
+        }
+        if (S == 0) {
+            return 0;
+        }
+        S = States[S].Fail;
+    }
+}
+
+bool BannedApiList::patternMatchesAt(const Pattern &P, StringRef Name, size_t End,
+                                     GeneralProgress &Progress) const {
+    switch (P.Kind) {
+    case PatternKind::Prefix:
+        return End + 1 == P.KeyLength;
+    case PatternKind::Suffix:
+        return End + 1 == Name.size();
+    case PatternKind::Substring:
+        return true;
+    case PatternKind::General: {
+        // Taking the earliest-ending hit of each literal in turn leaves the
+        // most room for the rest, so a name matches iff this reaches the last.
+        size_t Start = End + 1 - P.KeyLength;
+        auto &[NextSegment, MinStart] = Progress.try_emplace(P.Entry, 0u, 0u).first->second;
+        if (P.Segment != NextSegment || Start < MinStart || (P.AnchoredStart && Start != 0) ||
+            (P.AnchoredEnd && End + 1 != Name.size())) {
+            return false;
+        }
+        if (P.Last) {
+            return true;
+        }
+        NextSegment = P.Segment + 1;
+        MinStart = End + 1;
+        return false;
+    }
+    }
+    return false;
+}
+
+StringRef BannedApiList::match(StringRef Name) const {
+    if (MatchAllEntry >= 0) {
+        return Entries[MatchAllEntry];
+    }
+
+    auto Exact = ExactNames.find(Name);
+    if (Exact != ExactNames.end()) {
+        return Entries[Exact->second];
+    }
+
+    if (States.empty()) {
+        return {};
+    }
+
+    GeneralProgress Progress;
+
+    uint32_t S = 0;
+    for (size_t I = 0, E = Name.size(); I != E; ++I) {
+        S = next(S, static_cast<unsigned char>(Name[I]));
+
+        uint32_t T = States[S].Patterns.empty() ? States[S].OutputLink : S;
+        for (; T != NoState; T = States[T].OutputLink) {
+            for (uint32_t PatternIdx : States[T].Patterns) {
+                const Pattern &P = Patterns[PatternIdx];
+                if (patternMatchesAt(P, Name, I, Progress)) {
+                    return Entries[P.Entry];
+                }
+            }
+        }
+    }
+
+    return {};
+}
+
+} // namespace ota
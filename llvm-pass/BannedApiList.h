@@ -0,0 +1,83 @@
+#ifndef OTA_BANNED_API_LIST_H
+#define OTA_BANNED_API_LIST_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ota {
+
+// Deny list of banned callee symbols. Entries without '*' are exact names and
+// go into a hash table; entries with '*' are glob patterns ("MD5_*",
+// "*_sha1_*", "hal_*_raw_*"). All their literal segments are keys of one
+// Aho-Corasick automaton, and a pattern with several literals matches once
+// the scan has found them in order. Matching a name is a single scan over its
+// characters, plus one step per literal occurrence found, however many
+// entries the list holds.
+class BannedApiList {
+public:
+    // One entry per line; blank lines and lines starting with '#' are ignored.
+    static llvm::Expected<std::unique_ptr<BannedApiList>> loadFromFile(llvm::StringRef Path);
+
+    void add(llvm::StringRef Entry);
+
+    // Builds the automaton; must be called after the last add().
+    void finalize();
+
+    // Returns the deny-list entry that matches Name, or an empty StringRef.
+    llvm::StringRef match(llvm::StringRef Name) const;
+
+    size_t size() const { return Entries.size(); }
+    llvm::ArrayRef<std::string> entries() const { return Entries; }
+
+private:
+    enum class PatternKind { Prefix, Suffix, Substring, General };
+
+    // One literal of an entry. A general pattern has one per literal, the
+    // first and last anchored unless the entry starts or ends with '*'.
+    struct Pattern {
+        unsigned Entry;
+        PatternKind Kind;
+        unsigned KeyLength;
+        unsigned Segment = 0;
+        bool Last = true;
+        bool AnchoredStart = false;
+        bool AnchoredEnd = false;
+    };
+
+    // Per general pattern seen while matching one name: the literal it needs
+    // next and the first position that literal may start at.
+    using GeneralProgress = llvm::SmallDenseMap<unsigned, std::pair<unsigned, size_t>, 4>;
+
+    struct State {
+        uint32_t Fail = 0;
+        uint32_t OutputLink = NoState;
+        llvm::SmallVector<uint32_t, 1> Patterns;
+    };
+
+    static constexpr uint32_t NoState = ~0u;
+
+    void addKey(llvm::StringRef Key, const Pattern &P);
+    uint32_t next(uint32_t S, unsigned char C) const;
+    bool patternMatchesAt(const Pattern &P, llvm::StringRef Name, size_t End,
+                          GeneralProgress &Progress) const;
+
+    std::vector<std::string> Entries;
+    llvm::StringMap<unsigned> ExactNames;
+    std::vector<Pattern> Patterns;
+    int MatchAllEntry = -1;
+
+    std::vector<State> States;
+    llvm::DenseMap<uint64_t, uint32_t> Goto;
+};
+
+} // namespace ota
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef OTA_CALLEE_ROLES_H
+#define OTA_CALLEE_ROLES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace ota {
+
+// Role bits a callee can carry. A callee may carry more than one.
+enum CalleeRole : uint32_t {
+    RoleNone = 0,
+    RoleInstall = 1u << 0,
+    RoleVerify = 1u << 1,
+    RoleTrustedSource = 1u << 2,
+    RoleSensitiveLogging = 1u << 3,
+    RoleWeakCrypto = 1u << 4,
+    RoleEraseSlot = 1u << 5,
+    RoleWriteSlot = 1u << 6,
+    // Never in the table below; set for callees on the external deny list.
+    RoleBanned = 1u << 7,
+};
+
+// Number of distinct role bits, e.g. for per-role bit vectors.
+constexpr unsigned RoleBitCount = 8;
+
+struct CalleeRoleEntry {
+    std::string_view Name;
+    uint32_t Roles;
+};
+
+// Known callee names. Add a name with one line here; the perfect hash below is
+// regenerated at compile time.
+inline constexpr CalleeRoleEntry CalleeRoleTable[] = {
+    {"install", RoleInstall},
+    {"installFirmware", RoleInstall},
+    {"applyUpdate", RoleInstall},
+
+    {"verifySignature", RoleVerify},
+    {"verify_signature", RoleVerify},
+    {"checkSignature", RoleVerify},
+
+    {"sourceTrusted", RoleTrustedSource},
+    {"isSourceTrusted", RoleTrustedSource},
+    {"validateSource", RoleTrustedSource},
+
+    {"eraseSlot", RoleEraseSlot},
+    {"writeSlot", RoleWriteSlot},
+
+    {"printf", RoleSensitiveLogging},
+    {"puts", RoleSensitiveLogging},
+    {"fprintf", RoleSensitiveLogging},
+    {"perror", RoleSensitiveLogging},
+    {"syslog", RoleSensitiveLogging},
+    {"vsyslog", RoleSensitiveLogging},
+    {"snprintf", RoleSensitiveLogging},
+
+    {"MD5", RoleWeakCrypto},
+    {"MD5_Init", RoleWeakCrypto},
+    {"MD5_Update", RoleWeakCrypto},
+    {"MD5_Final", RoleWeakCrypto},
+    {"SHA1", RoleWeakCrypto},
+    {"SHA1_Init", RoleWeakCrypto},
+    {"SHA1_Update", RoleWeakCrypto},
+    {"SHA1_Final", RoleWeakCrypto},
+    {"rand", RoleWeakCrypto},
+    {"srand", RoleWeakCrypto},
+};
+
+namespace detail {
+
+// A name is keyed by its length and its first, middle and last characters,
+// which is enough to tell the table's names apart. Most callees are not in
+// the table; they land on an empty or different slot and are rejected by
+// length before any compare.
+constexpr uint32_t calleeNameKey(std::string_view Name) {
+    return static_cast<uint32_t>(Name.size()) ^
+           (static_cast<uint32_t>(static_cast<unsigned char>(Name.front())) << 8) ^
+           (static_cast<uint32_t>(static_cast<unsigned char>(Name[Name.size() / 2])) << 16) ^
+           (static_cast<uint32_t>(static_cast<unsigned char>(Name.back())) << 24);
+}
+
+constexpr size_t NumCalleeRoles = sizeof(CalleeRoleTable) / sizeof(CalleeRoleTable[0]);
+
+constexpr unsigned roleSlotBits() {
+    // Two slots per name.
+    unsigned Bits = 0;
+    while ((size_t(1) << Bits) < 2 * NumCalleeRoles) {
+        ++Bits;
+    }
+    return Bits;
+}
+
+constexpr unsigned RoleSlotBits = roleSlotBits();
+constexpr size_t RoleSlotCount = size_t(1) << RoleSlotBits;
+
+// Multiply-shift: the top bits of the key times an odd multiplier.
+constexpr uint32_t hashCalleeName(std::string_view Name, uint32_t Seed) {
+    return (calleeNameKey(Name) * (Seed * 0x9E3779B9u | 1u)) >> (32 - RoleSlotBits);
+}
+
+constexpr bool seedIsPerfect(uint32_t Seed) {
+    bool Used[RoleSlotCount] = {};
+    for (const CalleeRoleEntry &E : CalleeRoleTable) {
+        uint32_t Slot = hashCalleeName(E.Name, Seed);
+        if (Used[Slot]) {
+            return false;
+        }
+        Used[Slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findPerfectSeed() {
+    for (uint32_t Seed = 1; Seed < 10000; ++Seed) {
+        if (seedIsPerfect(Seed)) {
+            return Seed;
+        }
+    }
+    return 0;
+}
+
+constexpr uint32_t RoleSeed = findPerfectSeed();
+static_assert(RoleSeed != 0, "no perfect hash seed for CalleeRoleTable; two names may share "
+                             "their length and first, middle and last characters");
+
+struct RoleSlots {
+    CalleeRoleEntry Slots[RoleSlotCount];
+};
+
+constexpr RoleSlots buildRoleSlots() {
+    RoleSlots Table = {};
+    for (const CalleeRoleEntry &E : CalleeRoleTable) {
+        Table.Slots[hashCalleeName(E.Name, RoleSeed)] = E;
+    }
+    return Table;
+}
+
+inline constexpr RoleSlots RoleTable = buildRoleSlots();
+
+} // namespace detail
+
+// One multiply, a length check and at most one string compare; names not in
+// the table have no role.
+constexpr uint32_t lookupCalleeRoles(std::string_view Name) {
+    if (Name.empty()) {
+        return RoleNone;
+    }
+    const CalleeRoleEntry &Slot = detail::RoleTable.Slots[detail::hashCalleeName(Name, detail::RoleSeed)];
+    return Slot.Name.size() == Name.size() && Slot.Name == Name ? Slot.Roles : RoleNone;
+}
+
+static_assert(lookupCalleeRoles("install") == RoleInstall, "role table lookup is broken");
+static_assert(lookupCalleeRoles("memcpy") == RoleNone, "role table lookup is broken");
+static_assert(lookupCalleeRoles("") == RoleNone, "role table lookup is broken");
+
+} // namespace ota
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef OTA_POLICY_H
+#define OTA_POLICY_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/Error.h"
+
+#include "AnnotatedRoles.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class CallBase;
+class Function;
+class Module;
+class Value;
+} // namespace llvm
+
+namespace ota {
+
+// Whether F is one of the entry points the policy checks: named by
+// -ota-entry (default updateFirmware) or annotated ota_entry.
+bool isEntryPoint(const llvm::Function &F, const AnnotatedRoles &Annotations);
+
+// Whether M defines an entry point or refers to an install-role function,
+// by name, annotation or stored summary.
+// Only the symbol table is consulted: no function body is read, so on a
+// lazily loaded module nothing is materialized. A module for which this is
+// false passes the policy without being analyzed.
+bool isPolicyRelevant(const llvm::Module &M);
+
+// A call whose callee carries CalleeRole bits, by name or through the summary
+// of the helper it calls.
+struct PolicyCallSite {
+    llvm::CallBase *Call;
+    uint32_t Roles;
+    bool Summarized;
+};
+
+// What the checks established about one install or slot write.
+struct GuardedSiteStatus {
+    llvm::CallBase *Call;
+    uint32_t Roles;
+    // Prerequisite roles performed on every path from the entry to the call.
+    // For an install, signature verification counts only when it is of the
+    // package being installed.
+    uint32_t RolesBefore;
+    // The package the call acts on, and the argument of the enclosing function
+    // it derives from (-1 when none or several).
+    llvm::Value *Subject;
+    int SubjectArgument;
+    // For installs, whether a rollback guard on Subject gates the call.
+    bool RollbackGuarded;
+};
+
+// A rule of the policy, as named in violations and SARIF logs.
+struct PolicyRule {
+    const char *Id;
+    const char *Description;
+};
+
+llvm::ArrayRef<PolicyRule> policyRules();
+
+// One block of a witness path, at its first source line when known.
+struct WitnessStep {
+    std::string Block;
+    std::string File;
+    unsigned Line = 0;
+};
+
+// One violation: the rule broken, the entry point it was found in, and the
+// offending call.
+struct PolicyViolation {
+    std::string Rule;
+    std::string Function;
+    std::string Message;
+    // Position of the call from its DILocation; File is empty when the
+    // module has no debug info, and Site then holds the call as IR instead.
+    std::string File;
+    unsigned Line = 0;
+    unsigned Column = 0;
+    std::string Site;
+    // For an ordering rule, a shortest path from the entry to the call that
+    // skips the prerequisite; empty for the other rules.
+    std::vector<WitnessStep> Witness;
+
+    // Message followed by the position, or by the IR when there is none.
+    std::string describe() const;
+};
+
+// An analysis budget (-ota-max-blocks, -ota-max-provenance-steps or
+// -ota-time-budget-ms) that a function ran out of, with what it used.
+struct BudgetOverrun {
+    std::string Function;
+    std::string Budget;
+    uint64_t Used = 0;
+    uint64_t Limit = 0;
+};
+
+// The policy engine's view of one function: its classified call sites, the
+// status of every guarded call in program order, and the resulting violations
+// (empty when the function passes).
+struct PolicyResult {
+    std::vector<PolicyCallSite> CallSites;
+    std::vector<GuardedSiteStatus> GuardedSites;
+    std::vector<PolicyViolation> Violations;
+    // Budgets the function, or a helper it relies on, ran out of. The
+    // function or helper was then checked conservatively: only calls and
+    // guards that dominate a guarded call count for it.
+    std::vector<BudgetOverrun> Overruns;
+};
+
+// The violations of one function, reported through the LLVMContext
+// diagnostic handler with error severity and located at the function's
+// definition when it has debug info. A tool that handles these itself decides
+// how the run ends; otherwise the passes print them and fail once every entry
+// point has been checked.
+class PolicyViolationDiagnostic : public llvm::DiagnosticInfoWithLocationBase {
+public:
+    PolicyViolationDiagnostic(const llvm::Function &F, llvm::ArrayRef<PolicyViolation> Violations);
+
+    llvm::ArrayRef<PolicyViolation> violations() const { return Violations; }
+
+    void print(llvm::DiagnosticPrinter &DP) const override;
+
+    static bool classof(const llvm::DiagnosticInfo *DI);
+
+private:
+    llvm::ArrayRef<PolicyViolation> Violations;
+};
+
+// Warns that a function ran out of an analysis budget while F was checked,
+// and was checked or summarized conservatively instead.
+class PolicyBudgetDiagnostic : public llvm::DiagnosticInfoWithLocationBase {
+public:
+    PolicyBudgetDiagnostic(const llvm::Function &F, const BudgetOverrun &Overrun);
+
+    const BudgetOverrun &overrun() const { return Overrun; }
+
+    void print(llvm::DiagnosticPrinter &DP) const override;
+
+    static bool classof(const llvm::DiagnosticInfo *DI);
+
+private:
+    const BudgetOverrun &Overrun;
+};
+
+// Writes Violations to Path as a SARIF 2.1.0 log with one run, listing every
+// rule of the policy and one result per violation.
+llvm::Error writeSarifLog(llvm::StringRef Path, llvm::ArrayRef<PolicyViolation> Violations);
+
+// Helper summaries for a whole module, computed once from its entry points,
+// and the per-function results built on them. computeAll() fills in results
+// for several functions at once on a thread pool, preparing everything that
+// touches the analysis manager or the LLVMContext before the tasks start.
+class ModulePolicy {
+public:
+    explicit ModulePolicy(llvm::Module &M);
+    ModulePolicy(ModulePolicy &&);
+    ~ModulePolicy();
+
+    // The stored result for F, or null if it has not been computed.
+    const PolicyResult *lookup(const llvm::Function &F) const;
+
+    void computeAll(llvm::ArrayRef<llvm::Function *> Functions, llvm::FunctionAnalysisManager &FAM);
+
+private:
+    struct SharedSummaries;
+
+    std::unique_ptr<SharedSummaries> Shared;
+    llvm::DenseMap<const llvm::Function *, std::unique_ptr<PolicyResult>> Results;
+};
+
+// Module-level half of the engine: traversal-module-pass runs through it, so
+// later module-level checks in the same pipeline reuse its results.
+class OTAModulePolicyAnalysis : public llvm::AnalysisInfoMixin<OTAModulePolicyAnalysis> {
+    friend llvm::AnalysisInfoMixin<OTAModulePolicyAnalysis>;
+    static llvm::AnalysisKey Key;
+
+public:
+    using Result = ModulePolicy;
+    Result run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+};
+
+// The policy result of one function, with its helpers summarized for it
+// alone. Function-level checks share it, and traversal-module-pass reuses it
+// for any entry point it is already cached for. It is invalidated when F
+// changes and reflects F's helpers as they were when it was computed.
+class OTAPolicyAnalysis : public llvm::AnalysisInfoMixin<OTAPolicyAnalysis> {
+    friend llvm::AnalysisInfoMixin<OTAPolicyAnalysis>;
+    static llvm::AnalysisKey Key;
+
+public:
+    using Result = PolicyResult;
+    Result run(llvm::Function &F, llvm::FunctionAnalysisManager &FAM);
+};
+
+} // namespace ota
+
+#endif
@@ -0,0 +1,135 @@
+#include "OTAPolicy.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace ota {
+
+namespace {
+
+void physicalLocation(json::OStream &J, StringRef File, unsigned Line, unsigned Column) {
+    if (File.empty()) {
+        return;
+    }
+    J.attributeObject("physicalLocation", [&] {
+        J.attributeObject("artifactLocation", [&] { J.attribute("uri", File); });
+        if (Line != 0) {
+            J.attributeObject("region", [&] {
+                J.attribute("startLine", Line);
+                if (Column != 0) {
+                    J.attribute("startColumn", Column);
+                }
+            });
+        }
+    });
+}
+
+// The witness path, one location per block.
+void threadFlow(json::OStream &J, ArrayRef<WitnessStep> Witness) {
+    J.attributeArray("threadFlows", [&] {
+        J.object([&] {
+            J.attributeArray("locations", [&] {
+                for (const WitnessStep &Step : Witness) {
+                    J.object([&] {
+                        J.attributeObject("location", [&] {
+                            physicalLocation(J, Step.File, Step.Line, 0);
+                            J.attributeObject("message", [&] { J.attribute("text", Step.Block); });
+                        });
+                    });
+                }
+            });
+        });
+    });
+}
+
+} // namespace
+
+Error writeSarifLog(StringRef Path, ArrayRef<PolicyViolation> Violations) {
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+    if (EC) {
+        return createStringError(EC, "cannot write SARIF log '%s': %s", Path.str().c_str(),
+                                 EC.message().c_str());
+    }
+
+    StringMap<unsigned> RuleIndex;
+    for (const PolicyRule &Rule : policyRules()) {
+        RuleIndex.try_emplace(Rule.Id, RuleIndex.size());
+    }
+
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attribute("$schema", "https://json.schemastore.org/sarif-2.1.0.json");
+        J.attribute("version", "2.1.0");
+        J.attributeArray("runs", [&] {
+            J.object([&] {
+                J.attributeObject("tool", [&] {
+                    J.attributeObject("driver", [&] {
+                        J.attribute("name", "ota-security-pass");
+                        J.attribute("version", OTA_PLUGIN_VERSION);
+                        J.attributeArray("rules", [&] {
+                            for (const PolicyRule &Rule : policyRules()) {
+                                J.object([&] {
+                                    J.attribute("id", Rule.Id);
+                                    J.attributeObject("shortDescription", [&] {
+                                        J.attribute("text", Rule.Description);
+                                    });
+                                });
+                            }
+                        });
+                    });
+                });
+
+                J.attributeArray("results", [&] {
+                    for (const PolicyViolation &V : Violations) {
+                        J.object([&] {
+                            J.attribute("ruleId", V.Rule);
+                            auto It = RuleIndex.find(V.Rule);
+                            if (It != RuleIndex.end()) {
+                                J.attribute("ruleIndex", It->second);
+                            }
+                            J.attribute("level", "error");
+                            J.attributeObject("message", [&] {
+                                J.attribute("text", V.File.empty() && !V.Site.empty()
+                                                        ? V.Message + " at " + V.Site
+                                                        : V.Message);
+                            });
+                            J.attributeArray("locations", [&] {
+                                J.object([&] {
+                                    physicalLocation(J, V.File, V.Line, V.Column);
+                                    J.attributeArray("logicalLocations", [&] {
+                                        J.object([&] {
+                                            J.attribute("name", V.Function);
+                                            J.attribute("kind", "function");
+                                        });
+                                    });
+                                });
+                            });
+                            if (!V.Witness.empty()) {
+                                J.attributeArray("codeFlows", [&] {
+                                    J.object([&] { threadFlow(J, V.Witness); });
+                                });
+                            }
+                        });
+                    }
+                });
+            });
+        });
+    });
+    OS << "\n";
+
+    OS.close();
+    if (OS.has_error()) {
+        EC = OS.error();
+        OS.clear_error();
+        return createStringError(EC, "cannot write SARIF log '%s': %s", Path.str().c_str(),
+                                 EC.message().c_str());
+    }
+    return Error::success();
+}
+
+} // namespace ota
@@ -0,0 +1,267 @@
+#include "SummaryDatabase.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+namespace ota {
+
+namespace {
+
+// A summary on its way into a new file, taken either from the old file or
+// from the caller; the arrays point into whichever owns them.
+struct PendingRecord {
+    StringRef Name;
+    uint8_t AlwaysRoles;
+    uint8_t IfNonZeroRoles;
+    uint8_t InstallPrereqs;
+    bool MayInstall;
+    bool InstallsRollbackGuarded;
+    int InstallArg;
+    ArrayRef<uint8_t> AlwaysArgRoles;
+    ArrayRef<uint8_t> IfNonZeroArgRoles;
+};
+
+PendingRecord pendingFrom(const SummaryDatabase::Entry &E) {
+    return {E.name(),
+            E.alwaysRoles(),
+            E.ifNonZeroRoles(),
+            E.installPrereqs(),
+            E.mayInstall(),
+            E.installsRollbackGuarded(),
+            E.installArg(),
+            E.alwaysArgRoles(),
+            E.ifNonZeroArgRoles()};
+}
+
+PendingRecord pendingFrom(const SymbolSummary &S) {
+    return {S.Name,
+            S.AlwaysRoles,
+            S.IfNonZeroRoles,
+            S.InstallPrereqs,
+            S.MayInstall,
+            S.InstallsRollbackGuarded,
+            S.InstallArg,
+            S.AlwaysArgRoles,
+            S.IfNonZeroArgRoles};
+}
+
+} // namespace
+
+constexpr char SummaryDatabase::Magic[8];
+
+SummaryDatabase::SummaryDatabase(std::unique_ptr<MemoryBuffer> Buffer) : Buffer(std::move(Buffer)) {
+    // Records are read in place, so their layout is the file format.
+    static_assert(sizeof(Record) == 20 && alignof(Record) == 1, "summary record layout changed");
+
+    const char *Start = this->Buffer->getBufferStart();
+    const auto *H = reinterpret_cast<const Header *>(Start);
+    NumRecords = H->NumRecords;
+    Records = reinterpret_cast<const Record *>(Start + sizeof(Header));
+    Blob = Start + sizeof(Header) + NumRecords * sizeof(Record);
+    BlobSize = H->BlobSize;
+}
+
+Expected<std::unique_ptr<SummaryDatabase>> SummaryDatabase::open(StringRef Path) {
+    // Not volatile and no null terminator, so large files are mapped rather
+    // than read.
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+        MemoryBuffer::getFile(Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!Buffer) {
+        return createStringError(Buffer.getError(), "cannot read summary database '%s': %s",
+                                 Path.str().c_str(), Buffer.getError().message().c_str());
+    }
+
+    StringRef Contents = (*Buffer)->getBuffer();
+    if (Contents.size() < sizeof(Header)) {
+        return createStringError(inconvertibleErrorCode(), "'%s' is not a summary database",
+                                 Path.str().c_str());
+    }
+
+    const auto *H = reinterpret_cast<const Header *>(Contents.data());
+    if (std::memcmp(H->Magic, Magic, sizeof(Magic)) != 0 || H->Version != FormatVersion) {
+        return createStringError(inconvertibleErrorCode(),
+                                 "'%s' is not a summary database of format version %u",
+                                 Path.str().c_str(), FormatVersion);
+    }
+
+    uint64_t ExpectedSize = sizeof(Header) + uint64_t(H->NumRecords) * sizeof(Record) + H->BlobSize;
+    if (Contents.size() != ExpectedSize) {
+        return createStringError(inconvertibleErrorCode(), "summary database '%s' is truncated",
+                                 Path.str().c_str());
+    }
+
+    return std::unique_ptr<SummaryDatabase>(new SummaryDatabase(std::move(*Buffer)));
+}
+
+StringRef SummaryDatabase::blob(uint32_t Offset, uint32_t Size) const {
+    if (uint64_t(Offset) + Size > BlobSize) {
+        return {};
+    }
+    return StringRef(Blob + Offset, Size);
+}
+
+Optional<SummaryDatabase::Entry> SummaryDatabase::lookup(StringRef Name) const {
+    const Record *End = Records + NumRecords;
+    const Record *It = std::lower_bound(Records, End, Name, [&](const Record &R, StringRef Key) {
+        return blob(R.NameOffset, R.NameSize) < Key;
+    });
+    if (It == End || blob(It->NameOffset, It->NameSize) != Name) {
+        return None;
+    }
+    return Entry(*this, *It);
+}
+
+StringRef SummaryDatabase::Entry::name() const {
+    return DB->blob(R->NameOffset, R->NameSize);
+}
+
+uint8_t SummaryDatabase::Entry::alwaysRoles() const { return R->AlwaysRoles; }
+uint8_t SummaryDatabase::Entry::ifNonZeroRoles() const { return R->IfNonZeroRoles; }
+uint8_t SummaryDatabase::Entry::installPrereqs() const { return R->InstallPrereqs; }
+bool SummaryDatabase::Entry::mayInstall() const { return R->Flags & FlagMayInstall; }
+
+bool SummaryDatabase::Entry::installsRollbackGuarded() const {
+    return R->Flags & FlagInstallsRollbackGuarded;
+}
+
+int SummaryDatabase::Entry::installArg() const {
+    uint16_t Arg = R->InstallArg;
+    return Arg == NoInstallArg ? -1 : Arg;
+}
+
+ArrayRef<uint8_t> SummaryDatabase::Entry::alwaysArgRoles() const {
+    return arrayRefFromStringRef(DB->blob(R->ArgRolesOffset, R->NumArgs));
+}
+
+ArrayRef<uint8_t> SummaryDatabase::Entry::ifNonZeroArgRoles() const {
+    return arrayRefFromStringRef(DB->blob(R->ArgRolesOffset + R->NumArgs, R->NumArgs));
+}
+
+Error SummaryDatabase::update(StringRef Path, std::vector<SymbolSummary> Summaries) {
+    // Parallel compiles may summarize into the same database; the lock makes
+    // each read-merge-rename step see the previous one's result.
+    while (true) {
+        LockFileManager Lock(Path);
+        switch (Lock.getState()) {
+        case LockFileManager::LFS_Error:
+            return createStringError(inconvertibleErrorCode(), "cannot lock summary database '%s': %s",
+                                     Path.str().c_str(), Lock.getErrorMessage().c_str());
+        case LockFileManager::LFS_Owned:
+            return rewrite(Path, std::move(Summaries));
+        case LockFileManager::LFS_Shared:
+            if (Lock.waitForUnlock() == LockFileManager::Res_Timeout) {
+                Lock.unsafeRemoveLockFile();
+            }
+            break;
+        }
+    }
+}
+
+Error SummaryDatabase::rewrite(StringRef Path, std::vector<SymbolSummary> Summaries) {
+    std::unique_ptr<SummaryDatabase> Old;
+    if (sys::fs::exists(Path)) {
+        auto OldOrErr = open(Path);
+        if (!OldOrErr) {
+            return OldOrErr.takeError();
+        }
+        Old = std::move(*OldOrErr);
+    }
+
+    // Last summary of a name wins; argument arrays share one length.
+    llvm::stable_sort(Summaries, [](const SymbolSummary &A, const SymbolSummary &B) {
+        return A.Name < B.Name;
+    });
+    std::vector<SymbolSummary *> New;
+    for (SymbolSummary &S : Summaries) {
+        S.IfNonZeroArgRoles.resize(S.AlwaysArgRoles.size());
+        if (!New.empty() && New.back()->Name == S.Name) {
+            New.back() = &S;
+        } else {
+            New.push_back(&S);
+        }
+    }
+
+    std::vector<Record> OutRecords;
+    std::string OutBlob;
+    auto Emit = [&](const PendingRecord &P) {
+        Record R;
+        R.NameOffset = OutBlob.size();
+        R.NameSize = P.Name.size();
+        OutBlob += P.Name;
+        R.ArgRolesOffset = OutBlob.size();
+        R.NumArgs = P.AlwaysArgRoles.size();
+        OutBlob.append(P.AlwaysArgRoles.begin(), P.AlwaysArgRoles.end());
+        OutBlob.append(P.IfNonZeroArgRoles.begin(), P.IfNonZeroArgRoles.end());
+        R.InstallArg = P.InstallArg < 0 ? NoInstallArg : static_cast<uint16_t>(P.InstallArg);
+        R.AlwaysRoles = P.AlwaysRoles;
+        R.IfNonZeroRoles = P.IfNonZeroRoles;
+        R.InstallPrereqs = P.InstallPrereqs;
+        R.Flags = (P.MayInstall ? FlagMayInstall : 0) |
+                  (P.InstallsRollbackGuarded ? FlagInstallsRollbackGuarded : 0);
+        OutRecords.push_back(R);
+    };
+
+    // Both sides are sorted by name, so one merge pass writes the new table.
+    size_t OldIdx = 0;
+    size_t OldCount = Old ? Old->size() : 0;
+    for (SymbolSummary *S : New) {
+        for (; OldIdx != OldCount; ++OldIdx) {
+            Entry E(*Old, Old->record(OldIdx));
+            if (E.name() >= S->Name) {
+                break;
+            }
+            Emit(pendingFrom(E));
+        }
+        if (OldIdx != OldCount && Entry(*Old, Old->record(OldIdx)).name() == S->Name) {
+            ++OldIdx;
+        }
+        Emit(pendingFrom(*S));
+    }
+    for (; OldIdx != OldCount; ++OldIdx) {
+        Emit(pendingFrom(Entry(*Old, Old->record(OldIdx))));
+    }
+
+    SmallString<128> TempPath;
+    int FD;
+    if (std::error_code EC = sys::fs::createUniqueFile(Path + ".tmp-%%%%%%", FD, TempPath)) {
+        return createStringError(EC, "cannot create summary database next to '%s': %s",
+                                 Path.str().c_str(), EC.message().c_str());
+    }
+
+    {
+        raw_fd_ostream OS(FD, /*shouldClose=*/true);
+        Header H;
+        std::memcpy(H.Magic, Magic, sizeof(Magic));
+        H.Version = FormatVersion;
+        H.NumRecords = OutRecords.size();
+        H.BlobSize = OutBlob.size();
+        OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+        OS.write(reinterpret_cast<const char *>(OutRecords.data()), OutRecords.size() * sizeof(Record));
+        OS << OutBlob;
+        OS.close();
+        if (OS.has_error()) {
+            std::error_code EC = OS.error();
+            OS.clear_error();
+            sys::fs::remove(TempPath);
+            return createStringError(EC, "cannot write summary database '%s': %s",
+                                     TempPath.c_str(), EC.message().c_str());
+        }
+    }
+
+    if (std::error_code EC = sys::fs::rename(TempPath, Path)) {
+        sys::fs::remove(TempPath);
+        return createStringError(EC, "cannot replace summary database '%s': %s",
+                                 Path.str().c_str(), EC.message().c_str());
+    }
+    return Error::success();
+}
+
+} // namespace ota
@@ -0,0 +1,122 @@
+#ifndef OTA_SUMMARY_DATABASE_H
+#define OTA_SUMMARY_DATABASE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ota {
+
+// One function's security summary as written to the database. Role masks use
+// the CalleeRole bits, which fit in a byte.
+struct SymbolSummary {
+    std::string Name;
+    uint8_t AlwaysRoles = 0;
+    uint8_t IfNonZeroRoles = 0;
+    uint8_t InstallPrereqs = 0;
+    bool MayInstall = false;
+    bool InstallsRollbackGuarded = false;
+    int16_t InstallArg = -1;
+    std::vector<uint8_t> AlwaysArgRoles;
+    std::vector<uint8_t> IfNonZeroArgRoles;
+};
+
+// Summaries of functions defined in other translation units, keyed by symbol
+// name. The file is a header, a table of fixed-size records sorted by name,
+// and a blob of names and per-argument role bytes the records point into. It
+// is memory-mapped and only the header is checked on open, so opening is
+// constant time and a lookup is a binary search that copies nothing.
+class SummaryDatabase {
+    struct Record;
+
+public:
+    // Read-only view of one record; every accessor reads the mapped file.
+    class Entry {
+    public:
+        llvm::StringRef name() const;
+        uint8_t alwaysRoles() const;
+        uint8_t ifNonZeroRoles() const;
+        uint8_t installPrereqs() const;
+        bool mayInstall() const;
+        bool installsRollbackGuarded() const;
+        int installArg() const;
+        llvm::ArrayRef<uint8_t> alwaysArgRoles() const;
+        llvm::ArrayRef<uint8_t> ifNonZeroArgRoles() const;
+
+    private:
+        friend class SummaryDatabase;
+        Entry(const SummaryDatabase &DB, const Record &R) : DB(&DB), R(&R) {}
+
+        const SummaryDatabase *DB;
+        const Record *R;
+    };
+
+    static llvm::Expected<std::unique_ptr<SummaryDatabase>> open(llvm::StringRef Path);
+
+    // Merges Summaries into the database at Path (created if missing), with a
+    // new summary replacing any stored one of the same name. Writers are
+    // serialized through a lock file; the new table is written next to the
+    // old one and renamed over it, so readers never see a partial table.
+    static llvm::Error update(llvm::StringRef Path, std::vector<SymbolSummary> Summaries);
+
+    llvm::Optional<Entry> lookup(llvm::StringRef Name) const;
+
+    size_t size() const { return NumRecords; }
+
+private:
+    using ulittle16_t = llvm::support::ulittle16_t;
+    using ulittle32_t = llvm::support::ulittle32_t;
+
+    struct Header {
+        char Magic[8];
+        ulittle32_t Version;
+        ulittle32_t NumRecords;
+        ulittle32_t BlobSize;
+    };
+
+    enum RecordFlags : uint8_t {
+        FlagMayInstall = 1u << 0,
+        FlagInstallsRollbackGuarded = 1u << 1,
+    };
+
+    struct Record {
+        ulittle32_t NameOffset;
+        ulittle32_t NameSize;
+        ulittle32_t ArgRolesOffset;
+        ulittle16_t NumArgs;
+        ulittle16_t InstallArg;
+        uint8_t AlwaysRoles;
+        uint8_t IfNonZeroRoles;
+        uint8_t InstallPrereqs;
+        uint8_t Flags;
+    };
+
+    static constexpr char Magic[8] = {'O', 'T', 'A', 'S', 'U', 'M', 'D', 'B'};
+    static constexpr uint32_t FormatVersion = 1;
+    static constexpr uint16_t NoInstallArg = 0xffff;
+
+    explicit SummaryDatabase(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
+    static llvm::Error rewrite(llvm::StringRef Path, std::vector<SymbolSummary> Summaries);
+
+    const Record &record(size_t Idx) const { return Records[Idx]; }
+    llvm::StringRef blob(uint32_t Offset, uint32_t Size) const;
+
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    const Record *Records = nullptr;
+    size_t NumRecords = 0;
+    const char *Blob = nullptr;
+    size_t BlobSize = 0;
+};
+
+} // namespace ota
+
+#endif
@@ -1,41 +1,363 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/TimeProfiler.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 
-#include <queue>
+#include "AnnotatedRoles.h"
+#include "BannedApiList.h"
+#include "CalleeRoles.h"
+#include "OTAPolicy.h"
+#include "SummaryDatabase.h"
+#include "VerdictCache.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 using namespace llvm;
 
+#define DEBUG_TYPE "ota-policy"
+
 namespace {
 
-static bool isInList(StringRef Name, std::initializer_list<StringRef> Names) {
-    for (StringRef N : Names) {
-        if (Name == N) {
-            return true;
+// Release builds of LLVM compile plain STATISTICs away; these are kept, but
+// a release opt or clang still cannot print -stats, so only ota-check and
+// -ota-timing-json report them there.
+ALWAYS_ENABLED_STATISTIC(NumFunctionsChecked, "Entry functions checked");
+ALWAYS_ENABLED_STATISTIC(NumCallSitesClassified, "Call sites classified with a security role");
+ALWAYS_ENABLED_STATISTIC(NumICmpsExamined, "Integer compares examined as guards or result tests");
+ALWAYS_ENABLED_STATISTIC(NumBFSNodesVisited, "Blocks visited by slice and witness searches");
+ALWAYS_ENABLED_STATISTIC(NumProvenanceSteps, "Derivation edges followed by value provenance");
+
+static cl::list<std::string> EntryPoints(
+    "ota-entry",
+    cl::desc("Entry function to check (repeatable; default: updateFirmware)"),
+    cl::value_desc("name"), cl::CommaSeparated);
+
+static cl::opt<unsigned> CheckThreads(
+    "ota-threads",
+    cl::desc("Worker threads for traversal-module-pass (0 = all hardware threads)"),
+    cl::init(0));
+
+static cl::opt<bool> ReportSlice(
+    "ota-report-slice",
+    cl::desc("Print the install slice size next to the function size"));
+
+static cl::opt<std::string> BannedApiListPath(
+    "ota-banned-api-list",
+    cl::desc("File of banned callee names and '*' glob patterns, one per line"),
+    cl::value_desc("path"));
+
+static cl::opt<std::string> SummaryDatabasePath(
+    "ota-summary-db",
+    cl::desc("Summary database of functions defined in other translation units; "
+             "read by the checks, updated by ota-summarize"),
+    cl::value_desc("path"));
+
+static cl::opt<bool> LTOCheck(
+    "ota-lto-check",
+    cl::desc("Check entry points in each ThinLTO backend module (full LTO on LLVM 15+ "
+             "checks the merged module whenever the plugin is loaded at link time; "
+             "on LLVM 14 setting this for a compile is an error)"));
+
+static cl::opt<bool> LTOSummarize(
+    "ota-lto-summarize",
+    cl::desc("Write this compile's summaries to -ota-summary-db at pipeline start, "
+             "for ThinLTO backends to read at link time"));
+
+static cl::opt<bool> PipelineCheck(
+    "ota-pipeline-check",
+    cl::desc("Check entry points inside the compile's own optimization pipeline, after early "
+             "simplification and before inlining, at any -O level"));
+
+static cl::opt<std::string> VerdictCacheDir(
+    "ota-cache-dir",
+    cl::desc("Directory of cached verdicts; entries whose code, callees and policy are "
+             "unchanged since an earlier run are not analyzed again"),
+    cl::value_desc("dir"));
+
+static cl::opt<std::string> SarifPath(
+    "ota-sarif",
+    cl::desc("Write every violation found in this process to a SARIF 2.1.0 log; each '%' "
+             "becomes a random hex digit, once per process"),
+    cl::value_desc("path"));
+
+static cl::opt<std::string> TimingJsonPath(
+    "ota-timing-json",
+    cl::desc("Write the time spent in each phase of each function's check to a JSON file"),
+    cl::value_desc("path"));
+
+static cl::opt<unsigned> MaxBlocks(
+    "ota-max-blocks",
+    cl::desc("Blocks the analysis of one function may visit before it falls back to the "
+             "conservative check (0 = no limit)"),
+    cl::init(4000000));
+
+static cl::opt<unsigned> MaxProvenanceSteps(
+    "ota-max-provenance-steps",
+    cl::desc("Provenance edges the analysis of one function may follow before it falls back "
+             "to the conservative check (0 = no limit)"),
+    cl::init(8000000));
+
+static cl::opt<unsigned> TimeBudgetMs(
+    "ota-time-budget-ms",
+    cl::desc("Milliseconds the analysis of one function may take before it falls back to "
+             "the conservative check (0 = no limit)"),
+    cl::init(0));
+
+// Loaded once per process and shared by every function and module checked.
+static const ota::BannedApiList *bannedApiList() {
+    static const std::unique_ptr<ota::BannedApiList> List =
+        []() -> std::unique_ptr<ota::BannedApiList> {
+        if (BannedApiListPath.empty()) {
+            return nullptr;
+        }
+
+        auto ListOrErr = ota::BannedApiList::loadFromFile(BannedApiListPath);
+        if (!ListOrErr) {
+            report_fatal_error(Twine("[OTA Security Pass] ") + toString(ListOrErr.takeError()), false);
+        }
+        return std::move(*ListOrErr);
+    }();
+    return List.get();
+}
+
+// Opened once per process; a database that does not exist yet is empty.
+static const ota::SummaryDatabase *summaryDatabase() {
+    static const std::unique_ptr<ota::SummaryDatabase> Database =
+        []() -> std::unique_ptr<ota::SummaryDatabase> {
+        if (SummaryDatabasePath.empty() || !sys::fs::exists(SummaryDatabasePath)) {
+            return nullptr;
+        }
+
+        auto DatabaseOrErr = ota::SummaryDatabase::open(SummaryDatabasePath);
+        if (!DatabaseOrErr) {
+            report_fatal_error(Twine("[OTA Security Pass] ") + toString(DatabaseOrErr.takeError()), false);
+        }
+        return std::move(*DatabaseOrErr);
+    }();
+    return Database.get();
+}
+
+// Chosen once per process, so every compile of a parallel build that shares an
+// -ota-sarif pattern writes its own log.
+static StringRef sarifLogPath() {
+    static const std::string Path = []() -> std::string {
+        if (!StringRef(SarifPath).contains('%')) {
+            return SarifPath;
         }
+        SmallString<128> Unique;
+        sys::fs::createUniquePath(SarifPath, Unique, /*MakeAbsolute=*/false);
+        return std::string(Unique.str());
+    }();
+    return Path;
+}
+
+// Parsed once per module per pass run; a malformed annotation is a
+// configuration error like an unreadable deny list.
+static ota::AnnotatedRoles parseAnnotations(const Module &M) {
+    auto AnnotationsOrErr = ota::AnnotatedRoles::parse(M);
+    if (!AnnotationsOrErr) {
+        report_fatal_error(Twine("[OTA Security Pass] ") + toString(AnnotationsOrErr.takeError()), false);
     }
-    return false;
+    return std::move(*AnnotationsOrErr);
 }
 
-static bool isNameMatch(StringRef Name,
-                        std::initializer_list<StringRef> AllowedNames) {
-    for (StringRef N : AllowedNames) {
-        if (Name == N) {
-            return true;
+static uint32_t calleeRoles(const Function &Callee, const ota::AnnotatedRoles &Annotations) {
+    StringRef Name = Callee.getName();
+    uint32_t Roles = ota::lookupCalleeRoles(std::string_view(Name.data(), Name.size()));
+    Roles |= Annotations.rolesOf(Callee);
+
+    if (const ota::BannedApiList *Banned = bannedApiList()) {
+        if (!Banned->match(Name).empty()) {
+            Roles |= ota::RoleBanned;
         }
     }
-    return false;
+    return Roles;
+}
+
+// Roles performed on a set of paths, overall and per argument (with that
+// argument, or a value derived from it, as the call's subject).
+struct SummaryRoles {
+    uint32_t Roles = ota::RoleNone;
+    SmallVector<uint32_t, 4> ArgRoles;
+};
+
+// What a defined helper does for its callers, so a call to validatePackage(pkg)
+// counts as the verification it wraps. Computed once per function, bottom-up
+// over the call graph, and reused at every call site.
+struct FunctionSummary {
+    // Prerequisite roles performed on every path that returns.
+    SummaryRoles Always;
+    // The same over only the paths that may return nonzero; callers get these
+    // along the branch edge taken when the call's result is nonzero.
+    SummaryRoles IfNonZero;
+    // Whether some path through the function reaches an install.
+    bool MayInstall = false;
+    // Roles established on every path to every install inside the function.
+    uint32_t InstallPrereqs = ota::RoleNone;
+    // Argument every internal install takes its package from, or -1.
+    int InstallArg = -1;
+    // Whether every internal install is already gated by a rollback guard.
+    bool InstallsRollbackGuarded = false;
+    // Budgets this function, or a helper its summary relies on, ran out of.
+    std::vector<ota::BudgetOverrun> Overruns;
+
+    uint32_t callSiteRoles() const {
+        return Always.Roles | IfNonZero.Roles | (MayInstall ? ota::RoleInstall : ota::RoleNone);
+    }
+};
+
+class FunctionSummaries {
+public:
+    explicit FunctionSummaries(const ota::AnnotatedRoles &Annotations) : Annotations(Annotations) {}
+
+    // Roles declared in source apply wherever these summaries do.
+    const ota::AnnotatedRoles &annotations() const { return Annotations; }
+
+    const FunctionSummary *lookup(const Function &F) const {
+        auto It = Summaries.find(&F);
+        return It == Summaries.end() ? nullptr : It->second.get();
+    }
+
+    void insert(const Function &F, FunctionSummary Summary) {
+        Summaries[&F] = std::make_unique<FunctionSummary>(std::move(Summary));
+    }
+
+    size_t size() const { return Summaries.size(); }
+
+private:
+    const ota::AnnotatedRoles &Annotations;
+    DenseMap<const Function *, std::unique_ptr<FunctionSummary>> Summaries;
+};
+
+struct RoleCallSite {
+    CallBase *Call;
+    uint32_t Roles;
+    // Set when the roles come from the callee's summary rather than its name.
+    const FunctionSummary *Summary = nullptr;
+};
+
+static void sortInProgramOrder(const Function &F, std::vector<RoleCallSite> &Sites) {
+    if (Sites.size() < 2) {
+        return;
+    }
+
+    DenseMap<const BasicBlock *, unsigned> BlockOrder;
+    unsigned Next = 0;
+    for (const BasicBlock &BB : F) {
+        BlockOrder[&BB] = Next++;
+    }
+
+    llvm::sort(Sites, [&](const RoleCallSite &A, const RoleCallSite &B) {
+        const BasicBlock *ABB = A.Call->getParent();
+        const BasicBlock *BBB = B.Call->getParent();
+        if (ABB != BBB) {
+            return BlockOrder.lookup(ABB) < BlockOrder.lookup(BBB);
+        }
+        return A.Call->comesBefore(B.Call);
+    });
+}
+
+// Roles a direct call to Callee carries: the role table and deny list decide
+// for named callees, otherwise the callee's summary does.
+static std::pair<uint32_t, const FunctionSummary *>
+classifyCallee(const Function &Callee, const FunctionSummaries &Summaries) {
+    uint32_t Roles = calleeRoles(Callee, Summaries.annotations());
+    if (Roles != ota::RoleNone) {
+        return {Roles, nullptr};
+    }
+
+    if (const FunctionSummary *Summary = Summaries.lookup(Callee)) {
+        return {Summary->callSiteRoles(), Summary};
+    }
+    return {ota::RoleNone, nullptr};
 }
 
+// Call sites of role-carrying callees, grouped by the function that contains
+// them. The module's functions are classified once and only their use lists
+// are walked, so the cost follows the number of relevant calls rather than the
+// number of instructions. Each caller's sites are kept in program order.
+class SecurityCallSiteIndex {
+public:
+    SecurityCallSiteIndex(Module &M, const FunctionSummaries &Summaries) {
+        for (Function &Callee : M) {
+            auto [Roles, Summary] = classifyCallee(Callee, Summaries);
+            if (Roles == ota::RoleNone) {
+                continue;
+            }
+
+            for (Use &U : Callee.uses()) {
+                auto *CB = dyn_cast<CallBase>(U.getUser());
+                if (!CB || !CB->isCallee(&U)) {
+                    continue;
+                }
+                ByCaller[CB->getFunction()].push_back({CB, Roles, Summary});
+                ++NumCallSitesClassified;
+            }
+        }
+
+        for (auto &Entry : ByCaller) {
+            sortInProgramOrder(*Entry.first, Entry.second);
+        }
+    }
+
+    // An index of one function's sites, already in program order.
+    SecurityCallSiteIndex(const Function &F, std::vector<RoleCallSite> Sites) {
+        if (!Sites.empty()) {
+            ByCaller[&F] = std::move(Sites);
+        }
+    }
+
+    ArrayRef<RoleCallSite> callSitesIn(const Function &F) const {
+        auto It = ByCaller.find(&F);
+        if (It == ByCaller.end()) {
+            return {};
+        }
+        return It->second;
+    }
+
+private:
+    DenseMap<const Function *, std::vector<RoleCallSite>> ByCaller;
+};
+
 static std::string blockNameOrFallback(const BasicBlock *BB) {
     if (!BB) {
         return "<null-bb>";
@@ -61,367 +383,2736 @@ static std::string instructionSite(const Instruction *I) {
     return OS.str();
 }
 
-static bool blockReachesTarget(BasicBlock *Start, BasicBlock *Target) {
-    if (!Start || !Target) {
-        return false;
+// The work one function's analysis may do. The slice, reachability,
+// provenance and ordering stages charge what they visit and stop once a limit
+// is hit; the caller then falls back to the conservative check.
+class WorkBudget {
+public:
+    explicit WorkBudget(const Function &F) : F(F), Start(Clock::now()) {}
+
+    bool chargeBlocks(uint64_t N = 1) { return charge(Blocks, N, MaxBlocks, "blocks"); }
+    bool chargeSteps(uint64_t N = 1) {
+        return charge(Steps, N, MaxProvenanceSteps, "provenance steps");
     }
 
-    if (Start == Target) {
+    bool exhausted() const { return Overrun.hasValue(); }
+    const Optional<ota::BudgetOverrun> &overrun() const { return Overrun; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // The clock is read once per ClockInterval units of work.
+    static constexpr uint64_t ClockInterval = 4096;
+
+    bool charge(uint64_t &Used, uint64_t N, uint64_t Limit, const char *Budget) {
+        if (Overrun) {
+            return false;
+        }
+        Used += N;
+        if (Limit != 0 && Used > Limit) {
+            Overrun = ota::BudgetOverrun{F.getName().str(), Budget, Used, Limit};
+            return false;
+        }
+        if (TimeBudgetMs != 0 && (SinceClockRead += N) >= ClockInterval) {
+            SinceClockRead = 0;
+            uint64_t Elapsed =
+                std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - Start).count();
+            if (Elapsed > TimeBudgetMs) {
+                Overrun = ota::BudgetOverrun{F.getName().str(), "time (ms)", Elapsed, TimeBudgetMs};
+                return false;
+            }
+        }
         return true;
     }
 
-    SmallPtrSet<BasicBlock *, 32> Visited;
-    std::queue<BasicBlock *> Q;
-    Visited.insert(Start);
-    Q.push(Start);
+    const Function &F;
+    Clock::time_point Start;
+    uint64_t Blocks = 0;
+    uint64_t Steps = 0;
+    uint64_t SinceClockRead = 0;
+    Optional<ota::BudgetOverrun> Overrun;
+};
 
-    while (!Q.empty()) {
-        BasicBlock *BB = Q.front();
-        Q.pop();
+// Blocks that can reach at least one install site (or another call guarded by
+// an ordering rule, or a return when summarizing), found by one backward walk
+// from those blocks. Blocks outside the slice can never execute before such a
+// point, so the ordering, rollback and provenance work is limited to it.
+class InstallSlice {
+public:
+    InstallSlice(Function &F, ArrayRef<Instruction *> Seeds, WorkBudget &Budget) {
+        std::vector<BasicBlock *> Worklist;
+        for (Instruction *Seed : Seeds) {
+            if (Members.insert(Seed->getParent()).second) {
+                Worklist.push_back(Seed->getParent());
+            }
+        }
 
-        for (BasicBlock *Succ : successors(BB)) {
-            if (Succ == Target) {
-                return true;
+        unsigned Visited = 0;
+        while (!Worklist.empty() && Budget.chargeBlocks()) {
+            BasicBlock *BB = Worklist.back();
+            Worklist.pop_back();
+            ++Visited;
+            for (BasicBlock *Pred : predecessors(BB)) {
+                if (Members.insert(Pred).second) {
+                    Worklist.push_back(Pred);
+                }
             }
-            if (Visited.insert(Succ).second) {
-                Q.push(Succ);
+        }
+        NumBFSNodesVisited += Visited;
+
+        // Keep function layout order so later walks are deterministic.
+        for (BasicBlock &BB : F) {
+            if (Members.count(&BB)) {
+                Blocks.push_back(&BB);
             }
         }
     }
 
-    return false;
-}
+    bool contains(const BasicBlock *BB) const { return Members.count(BB); }
+    ArrayRef<BasicBlock *> blocks() const { return Blocks; }
+    size_t size() const { return Blocks.size(); }
 
-static bool valueDerivedFrom(Value *V, const Value *Target,
-                             SmallPtrSetImpl<const Value *> &Visited) {
-    if (!V) {
-        return false;
-    }
+private:
+    SmallPtrSet<const BasicBlock *, 32> Members;
+    std::vector<BasicBlock *> Blocks;
+};
 
-    V = V->stripPointerCasts();
+// Answers "does block A reach block B" for one function in constant time.
+// Blocks are condensed into SCCs; scc_iterator hands them out in post-order, so
+// every successor SCC already has its closure when an SCC is numbered and the
+// closure bitsets only ever need to cover lower indices. Only SCCs inside the
+// install slice are numbered: a block outside it reaches no slice block, so
+// queries whose target is in the slice stay exact.
+class BlockReachability {
+public:
+    BlockReachability(Function &F, const InstallSlice &Slice, WorkBudget &Budget)
+        : Slice(Slice), Budget(Budget) {
+        if (F.empty() || Slice.size() == 0 || Budget.exhausted()) {
+            return;
+        }
 
-    if (V == Target) {
-        return true;
-    }
+        addSCCsFrom(&F.getEntryBlock());
 
-    if (!Visited.insert(V).second) {
-        return false;
+        // Blocks unreachable from entry still get an index so queries on them
+        // behave like a forward search from them would.
+        for (BasicBlock *BB : Slice.blocks()) {
+            if (!SCCIndex.count(BB) && !Budget.exhausted()) {
+                addSCCsFrom(BB);
+            }
+        }
     }
 
-    if (auto *LI = dyn_cast<LoadInst>(V)) {
-        return valueDerivedFrom(LI->getPointerOperand(), Target, Visited);
-    }
+    bool reaches(const BasicBlock *From, const BasicBlock *To) const {
+        if (!From || !To) {
+            return false;
+        }
 
-    if (auto *GEP = dyn_cast<GetElementPtrInst>(V)) {
-        return valueDerivedFrom(GEP->getPointerOperand(), Target, Visited);
-    }
+        if (From == To) {
+            return true;
+        }
 
-    if (auto *Cast = dyn_cast<CastInst>(V)) {
-        return valueDerivedFrom(Cast->getOperand(0), Target, Visited);
+        auto FromIt = SCCIndex.find(From);
+        auto ToIt = SCCIndex.find(To);
+        if (FromIt == SCCIndex.end() || ToIt == SCCIndex.end()) {
+            return false;
+        }
+
+        unsigned FromSCC = FromIt->second;
+        unsigned ToSCC = ToIt->second;
+        if (FromSCC == ToSCC) {
+            return true;
+        }
+
+        return ToSCC < FromSCC && Closure[FromSCC].test(ToSCC);
     }
 
-    if (auto *AI = dyn_cast<AllocaInst>(V)) {
-        // At -O0, function args are commonly stored to allocas and later reloaded.
-        for (User *U : AI->users()) {
-            auto *SI = dyn_cast<StoreInst>(U);
-            if (!SI || SI->getPointerOperand() != AI) {
+private:
+    void addSCCsFrom(BasicBlock *Root) {
+        for (scc_iterator<BasicBlock *> It = scc_begin(Root); !It.isAtEnd(); ++It) {
+            const std::vector<BasicBlock *> &SCC = *It;
+            if (!Budget.chargeBlocks(SCC.size())) {
+                return;
+            }
+            if (!Slice.contains(SCC.front()) || SCCIndex.count(SCC.front())) {
                 continue;
             }
 
-            if (valueDerivedFrom(SI->getValueOperand(), Target, Visited)) {
-                return true;
+            unsigned Idx = Closure.size();
+            for (BasicBlock *BB : SCC) {
+                SCCIndex[BB] = Idx;
+            }
+
+            BitVector Reach(Idx);
+            for (BasicBlock *BB : SCC) {
+                for (BasicBlock *Succ : successors(BB)) {
+                    auto SuccIt = SCCIndex.find(Succ);
+                    if (SuccIt == SCCIndex.end() || SuccIt->second == Idx) {
+                        continue;
+                    }
+                    // A merge costs one block visit per word of the set.
+                    unsigned SuccIdx = SuccIt->second;
+                    if (!Budget.chargeBlocks(SuccIdx / 64 + 1)) {
+                        return;
+                    }
+                    Reach.set(SuccIdx);
+                    Reach |= Closure[SuccIdx];
+                }
             }
+            Closure.push_back(std::move(Reach));
         }
     }
 
-    if (auto *PHI = dyn_cast<PHINode>(V)) {
-        for (Value *Incoming : PHI->incoming_values()) {
-            if (valueDerivedFrom(Incoming, Target, Visited)) {
-                return true;
+    const InstallSlice &Slice;
+    WorkBudget &Budget;
+    DenseMap<const BasicBlock *, unsigned> SCCIndex;
+    std::vector<BitVector> Closure;
+};
+
+// Provenance of every SSA value in a function, solved once as a fixpoint over
+// the derivation edges the rollback rule follows (loads, GEPs, casts, stores
+// into allocas, PHIs and selects). Each value gets the set of roots it derives
+// from -- the function arguments plus any anchors the caller asks about, such
+// as install operands -- and whether it reads the current_version global.
+// Only instructions in the install slice are visited; stores outside it cannot
+// execute before an install and so never feed a value the rules look at.
+class ValueProvenance {
+public:
+    ValueProvenance(Function &F, const InstallSlice &Slice, ArrayRef<Value *> Anchors,
+                    WorkBudget &Budget) {
+        for (Argument &A : F.args()) {
+            addRoot(&A);
+        }
+        for (Value *Anchor : Anchors) {
+            if (Anchor) {
+                addRoot(Anchor->stripPointerCasts());
             }
         }
-        return false;
-    }
 
-    if (auto *Sel = dyn_cast<SelectInst>(V)) {
-        return valueDerivedFrom(Sel->getTrueValue(), Target, Visited) ||
-               valueDerivedFrom(Sel->getFalseValue(), Target, Visited);
-    }
+        PointerArgRoots.resize(RootValues.size());
+        for (Argument &A : F.args()) {
+            if (A.getType()->isPointerTy()) {
+                PointerArgRoots.set(RootIndex.lookup(&A));
+            }
+        }
 
-    return false;
-}
+        if (Budget.exhausted()) {
+            return;
+        }
+        for (BasicBlock *BB : Slice.blocks()) {
+            for (Instruction &I : *BB) {
+                if (isa<LoadInst>(I) || isa<GetElementPtrInst>(I) || isa<CastInst>(I) ||
+                    isa<AllocaInst>(I) || isa<PHINode>(I) || isa<SelectInst>(I)) {
+                    nodeFor(&I);
+                }
+            }
+        }
 
-static bool isPkgDerived(Value *V, Value *PkgArg) {
-    SmallPtrSet<const Value *, 32> Visited;
-    return valueDerivedFrom(V, PkgArg, Visited);
-}
+        // Edges run from a source value to the value derived from it.
+        std::vector<SmallVector<std::pair<unsigned, bool>, 4>> Users(Nodes.size());
+        for (unsigned Idx = 0, E = Nodes.size(); Idx != E; ++Idx) {
+            forEachSource(Nodes[Idx], Slice, [&](Value *Src, bool ThroughStore) {
+                Src = Src->stripPointerCasts();
+
+                if (!ThroughStore) {
+                    if (auto *GV = dyn_cast<GlobalVariable>(Src)) {
+                        if (GV->getName() == "current_version") {
+                            CurrentVersion.set(Idx);
+                        }
+                    }
+                }
 
-static bool isCurrentVersionDerivedImpl(Value *V,
-                                        SmallPtrSetImpl<const Value *> &Visited) {
+                auto It = NodeIndex.find(Src);
+                if (It != NodeIndex.end()) {
+                    Users[It->second].push_back({Idx, ThroughStore});
+                }
+            });
+        }
 
-    if (!V) {
-        return false;
-    }
+        std::vector<unsigned> Worklist;
+        for (unsigned Idx = 0, E = Nodes.size(); Idx != E; ++Idx) {
+            if (Roots[Idx].any() || CurrentVersion.test(Idx)) {
+                Worklist.push_back(Idx);
+            }
+        }
 
-    V = V->stripPointerCasts();
+        unsigned Steps = 0;
+        while (!Worklist.empty()) {
+            unsigned Src = Worklist.back();
+            Worklist.pop_back();
 
-    if (auto *GV = dyn_cast<GlobalVariable>(V)) {
-        return GV->getName() == "current_version";
-    }
+            for (const auto &Edge : Users[Src]) {
+                if (!Budget.chargeSteps()) {
+                    NumProvenanceSteps += Steps;
+                    return;
+                }
+                unsigned Dst = Edge.first;
+                bool Changed = false;
+                ++Steps;
 
-    if (!Visited.insert(V).second) {
-        return false;
+                if (Roots[Src].test(Roots[Dst])) {
+                    Roots[Dst] |= Roots[Src];
+                    Changed = true;
+                }
+
+                if (!Edge.second && CurrentVersion.test(Src) && !CurrentVersion.test(Dst)) {
+                    CurrentVersion.set(Dst);
+                    Changed = true;
+                }
+
+                if (Changed) {
+                    Worklist.push_back(Dst);
+                }
+            }
+        }
+        NumProvenanceSteps += Steps;
     }
 
-    if (auto *LI = dyn_cast<LoadInst>(V)) {
-        return isCurrentVersionDerivedImpl(LI->getPointerOperand(), Visited);
+    bool derivesFrom(Value *V, Value *Root) const {
+        if (!V || !Root) {
+            return false;
+        }
+
+        V = V->stripPointerCasts();
+        Root = Root->stripPointerCasts();
+        if (V == Root) {
+            return true;
+        }
+
+        auto NodeIt = NodeIndex.find(V);
+        auto RootIt = RootIndex.find(Root);
+        if (NodeIt == NodeIndex.end() || RootIt == RootIndex.end()) {
+            return false;
+        }
+        return Roots[NodeIt->second].test(RootIt->second);
     }
 
-    if (auto *GEP = dyn_cast<GetElementPtrInst>(V)) {
-        return isCurrentVersionDerivedImpl(GEP->getPointerOperand(), Visited);
+    bool derivesFromPointerArg(Value *V) const {
+        if (!V) {
+            return false;
+        }
+
+        auto It = NodeIndex.find(V->stripPointerCasts());
+        return It != NodeIndex.end() && Roots[It->second].anyCommon(PointerArgRoots);
     }
 
-    if (auto *Cast = dyn_cast<CastInst>(V)) {
-        return isCurrentVersionDerivedImpl(Cast->getOperand(0), Visited);
+    bool readsCurrentVersion(Value *V) const {
+        if (!V) {
+            return false;
+        }
+
+        V = V->stripPointerCasts();
+        if (auto *GV = dyn_cast<GlobalVariable>(V)) {
+            return GV->getName() == "current_version";
+        }
+
+        auto It = NodeIndex.find(V);
+        return It != NodeIndex.end() && CurrentVersion.test(It->second);
     }
 
-    if (auto *PHI = dyn_cast<PHINode>(V)) {
-        for (Value *Incoming : PHI->incoming_values()) {
-            if (isCurrentVersionDerivedImpl(Incoming, Visited)) {
-                return true;
+private:
+    template <typename CallbackT>
+    static void forEachSource(Value *V, const InstallSlice &Slice, CallbackT Callback) {
+        if (auto *LI = dyn_cast<LoadInst>(V)) {
+            Callback(LI->getPointerOperand(), false);
+        } else if (auto *GEP = dyn_cast<GetElementPtrInst>(V)) {
+            Callback(GEP->getPointerOperand(), false);
+        } else if (auto *Cast = dyn_cast<CastInst>(V)) {
+            Callback(Cast->getOperand(0), false);
+        } else if (auto *AI = dyn_cast<AllocaInst>(V)) {
+            // At -O0, function args are commonly stored to allocas and later reloaded.
+            for (User *U : AI->users()) {
+                auto *SI = dyn_cast<StoreInst>(U);
+                if (SI && SI->getPointerOperand() == AI && Slice.contains(SI->getParent())) {
+                    Callback(SI->getValueOperand(), true);
+                }
+            }
+        } else if (auto *PHI = dyn_cast<PHINode>(V)) {
+            for (Value *Incoming : PHI->incoming_values()) {
+                Callback(Incoming, false);
             }
+        } else if (auto *Sel = dyn_cast<SelectInst>(V)) {
+            Callback(Sel->getTrueValue(), false);
+            Callback(Sel->getFalseValue(), false);
         }
-        return false;
     }
 
-    if (auto *Sel = dyn_cast<SelectInst>(V)) {
-        return isCurrentVersionDerivedImpl(Sel->getTrueValue(), Visited) ||
-               isCurrentVersionDerivedImpl(Sel->getFalseValue(), Visited);
+    unsigned nodeFor(Value *V) {
+        auto Inserted = NodeIndex.try_emplace(V, Nodes.size());
+        if (Inserted.second) {
+            Nodes.push_back(V);
+            Roots.emplace_back(RootValues.size());
+            CurrentVersion.resize(Nodes.size());
+        }
+        return Inserted.first->second;
     }
 
-    return false;
-}
+    void addRoot(Value *V) {
+        if (!RootIndex.try_emplace(V, RootValues.size()).second) {
+            return;
+        }
+        RootValues.push_back(V);
+        for (BitVector &R : Roots) {
+            R.resize(RootValues.size());
+        }
+        Roots[nodeFor(V)].set(RootIndex.lookup(V));
+    }
 
-static bool isCurrentVersionDerived(Value *V) {
-    SmallPtrSet<const Value *, 32> Visited;
-    return isCurrentVersionDerivedImpl(V, Visited);
-}
+    DenseMap<const Value *, unsigned> NodeIndex;
+    DenseMap<const Value *, unsigned> RootIndex;
+    std::vector<Value *> Nodes;
+    std::vector<Value *> RootValues;
+    std::vector<BitVector> Roots;
+    BitVector CurrentVersion;
+    BitVector PointerArgRoots;
+};
 
-static bool hasRollbackGuardBeforeInstall(Function &F, DominatorTree &DT,
-                                          Instruction *InstallI) {
-    auto *InstallCall = dyn_cast<CallInst>(InstallI);
-    if (!InstallCall || InstallCall->arg_size() == 0) {
-        return false;
+// The package object a pointer names, for telling whether two role calls act
+// on the same package. Casts and field addresses are stripped by
+// getUnderlyingObject, and a pointer reloaded from memory, such as a local at
+// -O0 or a struct field, is followed to the store MemorySSA's cached walker
+// finds must have written it. Arguments, allocas and globals are objects;
+// anything else, including a reload the walker cannot pin to one store, is
+// unknown and may be any package.
+class PackageObjects {
+public:
+    PackageObjects(MemorySSA &MSSA, AAResults &AA, WorkBudget &Budget)
+        : Walker(*MSSA.getWalker()), AA(AA), Budget(Budget) {}
+
+    // The object V points into, or null when unknown.
+    Value *objectOf(Value *V, unsigned Depth = 0) {
+        auto Cached = Objects.try_emplace(V, nullptr);
+        if (!Cached.second) {
+            return Cached.first->second;
+        }
+        Value *Object = resolve(V, Depth);
+        Objects[V] = Object;
+        return Object;
     }
 
-    Value *PkgArg = InstallCall->getArgOperand(0)->stripPointerCasts();
-    BasicBlock *InstallBB = InstallI->getParent();
+private:
+    // PHIs and selects nested deeper than this are unknown.
+    static constexpr unsigned MaxMergeDepth = 6;
 
-    for (BasicBlock &BB : F) {
-        for (Instruction &I : BB) {
-            auto *Cmp = dyn_cast<ICmpInst>(&I);
-            if (!Cmp) {
-                continue;
+    Value *resolve(Value *V, unsigned Depth) {
+        SmallPtrSet<Value *, 8> Visited;
+        while (Budget.chargeSteps()) {
+            V = getUnderlyingObject(V);
+            if (!Visited.insert(V).second) {
+                return nullptr;
             }
-
-            if (!DT.dominates(Cmp, InstallI)) {
-                continue;
+            if (isa<Argument>(V) || isa<AllocaInst>(V) || isa<GlobalVariable>(V)) {
+                return V;
             }
 
-            Value *LHS = Cmp->getOperand(0);
-            Value *RHS = Cmp->getOperand(1);
-
-            bool PkgL = isPkgDerived(LHS, PkgArg);
-            bool CurR = isCurrentVersionDerived(RHS);
-            bool CurL = isCurrentVersionDerived(LHS);
-            bool PkgR = isPkgDerived(RHS, PkgArg);
-
-            // Fallback for common IR shapes where compare value traces to another
-            // function argument aliasing the package pointer (through allocas).
-            if (!PkgL) {
-                for (Argument &A : F.args()) {
-                    if (A.getType()->isPointerTy() && isPkgDerived(LHS, &A)) {
-                        PkgL = true;
-                        break;
-                    }
+            if (auto *LI = dyn_cast<LoadInst>(V)) {
+                StoreInst *SI = reachingStore(LI);
+                if (!SI) {
+                    return nullptr;
                 }
+                V = SI->getValueOperand();
+                continue;
             }
 
-            if (!PkgR) {
-                for (Argument &A : F.args()) {
-                    if (A.getType()->isPointerTy() && isPkgDerived(RHS, &A)) {
-                        PkgR = true;
-                        break;
-                    }
+            // A PHI or select whose operands all name one object names it too.
+            SmallVector<Value *, 4> Merged;
+            if (auto *PHI = dyn_cast<PHINode>(V)) {
+                Merged.append(PHI->incoming_values().begin(), PHI->incoming_values().end());
+            } else if (auto *Sel = dyn_cast<SelectInst>(V)) {
+                Merged = {Sel->getTrueValue(), Sel->getFalseValue()};
+            }
+            if (Merged.empty() || Depth == MaxMergeDepth) {
+                return nullptr;
+            }
+            Value *Object = objectOf(Merged.front(), Depth + 1);
+            for (Value *Op : drop_begin(Merged)) {
+                if (!Object || objectOf(Op, Depth + 1) != Object) {
+                    return nullptr;
                 }
             }
+            return Object;
+        }
+        return nullptr;
+    }
 
-            ICmpInst::Predicate Pred = Cmp->getPredicate();
-
-            for (User *U : Cmp->users()) {
-                auto *Br = dyn_cast<BranchInst>(U);
-                if (!Br || !Br->isConditional() || Br->getCondition() != Cmp) {
-                    continue;
-                }
+    // The store that wrote the whole of what LI reads, if one must have.
+    StoreInst *reachingStore(LoadInst *LI) {
+        if (!LI->isUnordered()) {
+            return nullptr;
+        }
+        auto *Def = dyn_cast<MemoryDef>(Walker.getClobberingMemoryAccess(LI));
+        auto *SI = Def ? dyn_cast_or_null<StoreInst>(Def->getMemoryInst()) : nullptr;
+        if (!SI || !AA.isMustAlias(MemoryLocation::get(SI), MemoryLocation::get(LI)) ||
+            SI->getValueOperand()->getType() != LI->getType()) {
+            return nullptr;
+        }
+        return SI;
+    }
 
-                BasicBlock *TrueSucc = Br->getSuccessor(0);
-                BasicBlock *FalseSucc = Br->getSuccessor(1);
-                bool TrueReachesInstall = blockReachesTarget(TrueSucc, InstallBB);
-                bool FalseReachesInstall = blockReachesTarget(FalseSucc, InstallBB);
+    MemorySSAWalker &Walker;
+    AAResults &AA;
+    WorkBudget &Budget;
+    DenseMap<Value *, Value *> Objects;
+};
 
-                if (PkgL && CurR) {
-                    bool DirectStrictGT =
-                        (Pred == ICmpInst::ICMP_SGT || Pred == ICmpInst::ICMP_UGT) &&
-                        TrueReachesInstall && !FalseReachesInstall;
+// Forward must-dataflow over a bit-vector lattice: a fact holds at a point when
+// some event generating it executes on every path from the entry to that point.
+// Facts are never killed, so a block's exit state is its entry state plus
+// everything its events generate; a CFG edge may generate facts of its own,
+// such as the success edge of a branch on a helper's result. The slice is
+// closed under predecessors, so solving over it alone is exact for every event
+// inside it.
+class MustPrecedeDataflow {
+public:
+    MustPrecedeDataflow(Function &F, const InstallSlice &Slice, unsigned NumFacts,
+                        WorkBudget &Budget)
+        : Entry(F.empty() ? nullptr : &F.getEntryBlock()), Slice(Slice), NumFacts(NumFacts),
+          Budget(Budget) {}
 
-                    bool RejectLEThenInstall =
-                        (Pred == ICmpInst::ICMP_SLE || Pred == ICmpInst::ICMP_ULE) &&
-                        FalseReachesInstall && !TrueReachesInstall;
+    void addEvent(Instruction *I, const BitVector &Gen) {
+        BlockEvents[I->getParent()].push_back({I, Gen});
+    }
 
-                    if (DirectStrictGT || RejectLEThenInstall) {
-                        return true;
-                    }
-                }
+    void addEdgeFacts(const BasicBlock *From, const BasicBlock *To, const BitVector &Gen) {
+        BitVector &Facts = EdgeGen.try_emplace({From, To}, NumFacts).first->second;
+        Facts |= Gen;
+    }
 
-                if (CurL && PkgR) {
-                    bool DirectStrictGT =
-                        (Pred == ICmpInst::ICMP_SLT || Pred == ICmpInst::ICMP_ULT) &&
-                        TrueReachesInstall && !FalseReachesInstall;
+    // Leaves factsBefore() unanswered if the budget runs out.
+    void solve() {
+        if (Budget.exhausted()) {
+            return;
+        }
+        for (auto &Entry : BlockEvents) {
+            llvm::stable_sort(Entry.second, [](const Event &A, const Event &B) {
+                return A.I != B.I && A.I->comesBefore(B.I);
+            });
+        }
 
-                    bool RejectGEThenInstall =
-                        (Pred == ICmpInst::ICMP_SGE || Pred == ICmpInst::ICMP_UGE) &&
-                        FalseReachesInstall && !TrueReachesInstall;
+        ArrayRef<BasicBlock *> Blocks = Slice.blocks();
+        DenseMap<const BasicBlock *, unsigned> Index;
+        for (unsigned Idx = 0, E = Blocks.size(); Idx != E; ++Idx) {
+            Index[Blocks[Idx]] = Idx;
+        }
 
-                    if (DirectStrictGT || RejectGEThenInstall) {
-                        return true;
-                    }
-                }
+        std::vector<BitVector> Gen(Blocks.size(), BitVector(NumFacts));
+        for (const auto &Entry : BlockEvents) {
+            auto It = Index.find(Entry.first);
+            if (It == Index.end()) {
+                continue;
+            }
+            for (const Event &Ev : Entry.second) {
+                Gen[It->second] |= Ev.Gen;
             }
         }
-    }
 
-    return false;
-}
+        // Start from "everything holds" so loops settle at the greatest fixpoint.
+        std::vector<BitVector> Out(Blocks.size(), BitVector(NumFacts, true));
+        std::deque<unsigned> Worklist;
+        BitVector Queued(Blocks.size(), true);
+        for (unsigned Idx = 0, E = Blocks.size(); Idx != E; ++Idx) {
+            Worklist.push_back(Idx);
+        }
 
-class TraversalPass : public PassInfoMixin<TraversalPass> {
-public:
-    PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+        while (!Worklist.empty()) {
+            if (!Budget.chargeBlocks()) {
+                return;
+            }
+            unsigned Idx = Worklist.front();
+            Worklist.pop_front();
+            Queued.reset(Idx);
 
-        if (F.getName() != "updateFirmware")
-            return PreservedAnalyses::all();
+            BitVector NewOut = blockEntryState(Blocks[Idx], Index, Out);
+            NewOut |= Gen[Idx];
+            if (NewOut == Out[Idx]) {
+                continue;
+            }
+            Out[Idx] = std::move(NewOut);
 
-        DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+            for (BasicBlock *Succ : successors(Blocks[Idx])) {
+                auto It = Index.find(Succ);
+                if (It != Index.end() && !Queued.test(It->second)) {
+                    Queued.set(It->second);
+                    Worklist.push_back(It->second);
+                }
+            }
+        }
 
-        std::vector<CallInst *> InstallCalls;
-        std::vector<CallInst *> VerifyCalls;
-        std::vector<CallInst *> TrustedSourceCalls;
-        std::vector<std::string> Violations;
+        for (const auto &Entry : BlockEvents) {
+            if (!Index.count(Entry.first)) {
+                continue;
+            }
+            BitVector State = blockEntryState(Entry.first, Index, Out);
+            for (const Event &Ev : Entry.second) {
+                Before[Ev.I] = State;
+                State |= Ev.Gen;
+            }
+        }
+    }
 
-        const std::initializer_list<StringRef> InstallNames = {
-            "install", "installFirmware", "applyUpdate"
-        };
-        const std::initializer_list<StringRef> VerifyNames = {
-            "verifySignature", "verify_signature", "checkSignature"
-        };
-        const std::initializer_list<StringRef> TrustedSourceNames = {
-            "sourceTrusted", "isSourceTrusted", "validateSource"
-        };
+    // Facts that hold on every path from the entry to just before I, which
+    // must have been added as an event inside the slice.
+    const BitVector &factsBefore(const Instruction *I) const {
+        auto It = Before.find(I);
+        assert(It != Before.end() && "no dataflow event for instruction");
+        return It->second;
+    }
 
-        for (BasicBlock &BB : F) {
-            for (Instruction &I : BB) {
-                auto *CI = dyn_cast<CallInst>(&I);
-                if (!CI) {
-                    continue;
+    // A shortest path of blocks from the entry to I's block on which Fact is
+    // never established: one BFS over the slice with the blocks and edges that
+    // establish it left out. Empty when Fact holds before I. Only needed to
+    // explain a violation, so solve() does not compute it.
+    std::vector<const BasicBlock *> witnessPath(const Instruction *I, unsigned Fact) const {
+        const BasicBlock *Target = I->getParent();
+        auto Establishes = [&](const BasicBlock *BB) {
+            auto It = BlockEvents.find(BB);
+            if (It == BlockEvents.end()) {
+                return false;
+            }
+            for (const Event &Ev : It->second) {
+                if (Ev.I == I) {
+                    return false;
                 }
-
-                Function *Callee = CI->getCalledFunction();
-                if (!Callee) {
-                    continue;
+                if (Ev.Gen.test(Fact)) {
+                    return true;
                 }
+            }
+            return false;
+        };
 
-                StringRef Name = Callee->getName();
+        if (!Entry || Establishes(Entry)) {
+            return {};
+        }
 
-                if (isNameMatch(Name, InstallNames)) {
-                    InstallCalls.push_back(CI);
+        DenseMap<const BasicBlock *, const BasicBlock *> Parent;
+        std::deque<const BasicBlock *> Worklist = {Entry};
+        Parent[Entry] = nullptr;
+        while (!Worklist.empty() && !Parent.count(Target)) {
+            const BasicBlock *BB = Worklist.front();
+            Worklist.pop_front();
+            ++NumBFSNodesVisited;
+            for (const BasicBlock *Succ : successors(BB)) {
+                if (Parent.count(Succ) || !Slice.contains(Succ)) {
                     continue;
                 }
-
-                if (isNameMatch(Name, VerifyNames)) {
-                    VerifyCalls.push_back(CI);
+                auto Edge = EdgeGen.find({BB, Succ});
+                if (Edge != EdgeGen.end() && Edge->second.test(Fact)) {
                     continue;
                 }
-
-                if (isNameMatch(Name, TrustedSourceNames)) {
-                    TrustedSourceCalls.push_back(CI);
+                Parent[Succ] = BB;
+                if (Succ != Target && Establishes(Succ)) {
                     continue;
                 }
-
-                if (isInList(Name,
-                             {"printf", "puts", "fprintf", "perror", "syslog", "vsyslog", "snprintf"})) {
-                    Violations.push_back("Sensitive logging API call inside updateFirmware(): " +
-                                         Name.str() + " at " + instructionSite(CI));
+                Worklist.push_back(Succ);
+            }
+        }
+
+        auto It = Parent.find(Target);
+        if (It == Parent.end()) {
+            return {};
+        }
+        std::vector<const BasicBlock *> Path;
+        for (const BasicBlock *BB = Target; BB; BB = Parent.lookup(BB)) {
+            Path.push_back(BB);
+        }
+        std::reverse(Path.begin(), Path.end());
+        return Path;
+    }
+
+private:
+    struct Event {
+        Instruction *I;
+        BitVector Gen;
+    };
+
+    BitVector blockEntryState(const BasicBlock *BB,
+                              const DenseMap<const BasicBlock *, unsigned> &Index,
+                              const std::vector<BitVector> &Out) const {
+        if (BB == Entry) {
+            return BitVector(NumFacts);
+        }
+
+        BitVector In(NumFacts, true);
+        for (const BasicBlock *Pred : predecessors(BB)) {
+            auto It = Index.find(Pred);
+            if (It == Index.end()) {
+                continue;
+            }
+
+            auto Edge = EdgeGen.find({Pred, BB});
+            if (Edge == EdgeGen.end()) {
+                In &= Out[It->second];
+            } else {
+                BitVector EdgeOut = Out[It->second];
+                EdgeOut |= Edge->second;
+                In &= EdgeOut;
+            }
+        }
+        return In;
+    }
+
+    const BasicBlock *Entry;
+    const InstallSlice &Slice;
+    unsigned NumFacts;
+    WorkBudget &Budget;
+    DenseMap<const BasicBlock *, SmallVector<Event, 4>> BlockEvents;
+    DenseMap<std::pair<const BasicBlock *, const BasicBlock *>, BitVector> EdgeGen;
+    DenseMap<const Instruction *, BitVector> Before;
+};
+
+// Part of every verdict cache key. Bump it with any change to the checks that
+// can give a different verdict for the same code.
+static constexpr unsigned PolicyVersion = 4;
+
+// Every call carrying GuardedRole must be preceded, on all paths from the
+// entry, by a call carrying PrerequisiteRole. Adding a rule is one line here.
+struct OrderingRule {
+    uint32_t PrerequisiteRole;
+    uint32_t GuardedRole;
+    const char *RuleId;
+    const char *Message;
+};
+
+static const OrderingRule OrderingRules[] = {
+    {ota::RoleVerify, ota::RoleInstall, "ota-verify-before-install",
+     "Install call is not dominated by signature verification on all paths"},
+    {ota::RoleTrustedSource, ota::RoleInstall, "ota-trusted-source-before-install",
+     "Install call is not dominated by trusted source validation on all paths"},
+    {ota::RoleEraseSlot, ota::RoleWriteSlot, "ota-erase-before-write",
+     "Slot write is not preceded by a slot erase on all paths"},
+};
+
+// Rule IDs are part of the reports CI consumes; never rename one.
+static const ota::PolicyRule PolicyRules[] = {
+    {"ota-sensitive-logging", "Sensitive logging API called from an entry point"},
+    {"ota-weak-crypto", "Weak crypto or weak entropy API called from an entry point"},
+    {"ota-banned-api", "Deny-listed API called from an entry point"},
+    {"ota-verify-before-install", "Install not preceded by signature verification on all paths"},
+    {"ota-trusted-source-before-install",
+     "Install not preceded by trusted source validation on all paths"},
+    {"ota-erase-before-write", "Slot write not preceded by a slot erase on all paths"},
+    {"ota-rollback-guard", "Install not gated by a rollback guard on the package version"},
+};
+
+static ota::PolicyViolation violationAt(StringRef Rule, const Function &F, const Instruction *I,
+                                        std::string Message) {
+    ota::PolicyViolation V;
+    V.Rule = Rule.str();
+    V.Function = F.getName().str();
+    V.Message = std::move(Message);
+    if (const DILocation *Loc = I->getDebugLoc().get()) {
+        V.File = Loc->getFilename().str();
+        V.Line = Loc->getLine();
+        V.Column = Loc->getColumn();
+    } else {
+        V.Site = instructionSite(I);
+    }
+    return V;
+}
+
+// Role facts occupy the first RoleBitCount bits; summaries append one block of
+// RoleBitCount bits per argument after them.
+static BitVector roleFacts(uint32_t Roles, unsigned NumFacts) {
+    BitVector Facts(NumFacts);
+    for (unsigned Bit = 0; Bit != ota::RoleBitCount; ++Bit) {
+        if (Roles & (1u << Bit)) {
+            Facts.set(Bit);
+        }
+    }
+    return Facts;
+}
+
+static uint32_t rolesIn(const BitVector &Facts, unsigned FirstBit = 0) {
+    uint32_t Roles = ota::RoleNone;
+    for (unsigned Bit = 0; Bit != ota::RoleBitCount; ++Bit) {
+        if (Facts.test(FirstBit + Bit)) {
+            Roles |= 1u << Bit;
+        }
+    }
+    return Roles;
+}
+
+static unsigned argFactBase(unsigned ArgNo) {
+    return ota::RoleBitCount * (ArgNo + 1);
+}
+
+static uint32_t orderingRoles() {
+    uint32_t Roles = ota::RoleNone;
+    for (const OrderingRule &Rule : OrderingRules) {
+        Roles |= Rule.PrerequisiteRole | Rule.GuardedRole;
+    }
+    return Roles;
+}
+
+static uint32_t guardedRoles() {
+    uint32_t Roles = ota::RoleNone;
+    for (const OrderingRule &Rule : OrderingRules) {
+        Roles |= Rule.GuardedRole;
+    }
+    return Roles;
+}
+
+// The compares a conditional branch tests, each with a successor the branch
+// only takes when the compare has the given value. Besides a bare icmp this
+// sees through `xor %c, true` and the and/or/select forms that SimplifyCFG and
+// InstCombine fold `&&` and `||` conditions into.
+static void forEachBranchCompare(BranchInst *Br,
+                                 function_ref<void(ICmpInst *, unsigned, bool)> Callback) {
+    using namespace PatternMatch;
+
+    // (condition, successor, value the condition has whenever it is taken)
+    SmallVector<std::tuple<Value *, unsigned, bool>, 8> Worklist = {
+        {Br->getCondition(), 0, true}, {Br->getCondition(), 1, false}};
+    DenseSet<std::pair<Value *, unsigned>> Seen;
+    while (!Worklist.empty()) {
+        auto [Cond, SuccIdx, Holds] = Worklist.pop_back_val();
+        if (!Seen.insert({Cond, SuccIdx * 2 + Holds}).second) {
+            continue;
+        }
+
+        Value *A;
+        Value *B;
+        if (auto *Cmp = dyn_cast<ICmpInst>(Cond)) {
+            ++NumICmpsExamined;
+            Callback(Cmp, SuccIdx, Holds);
+        } else if (match(Cond, m_Not(m_Value(A)))) {
+            Worklist.push_back({A, SuccIdx, !Holds});
+        } else if (Holds ? match(Cond, m_LogicalAnd(m_Value(A), m_Value(B)))
+                         : match(Cond, m_LogicalOr(m_Value(A), m_Value(B)))) {
+            Worklist.push_back({A, SuccIdx, Holds});
+            Worklist.push_back({B, SuccIdx, Holds});
+        }
+    }
+}
+
+// Whether Cmp, when it has the value Holds, says the package version is newer
+// than current_version, in either operand order.
+static bool provesNewerVersion(ICmpInst *Cmp, bool Holds, function_ref<bool(Value *)> IsPackage,
+                               function_ref<bool(Value *)> IsCurrent) {
+    auto IsGreater = [](ICmpInst::Predicate Pred) {
+        return Pred == ICmpInst::ICMP_SGT || Pred == ICmpInst::ICMP_UGT;
+    };
+
+    ICmpInst::Predicate Pred = Holds ? Cmp->getPredicate() : Cmp->getInversePredicate();
+    Value *LHS = Cmp->getOperand(0);
+    Value *RHS = Cmp->getOperand(1);
+    if (IsGreater(Pred) && IsPackage(LHS) && IsCurrent(RHS)) {
+        return true;
+    }
+    return IsGreater(ICmpInst::getSwappedPredicate(Pred)) && IsCurrent(LHS) && IsPackage(RHS);
+}
+
+// The only branches that can gate InstallBB are the conditional terminators
+// of its strict dominators, so walk the immediate-dominator chain and inspect
+// those instead of every compare in the function.
+static bool hasRollbackGuardBeforeInstall(DominatorTree &DT,
+                                          const BlockReachability &Reach,
+                                          const ValueProvenance &Prov, WorkBudget &Budget,
+                                          BasicBlock *InstallBB, Value *PkgArg) {
+    DomTreeNode *Node = DT.getNode(InstallBB);
+    if (!Node) {
+        return false;
+    }
+
+    // Compare operands that trace to any pointer argument also count as
+    // package-derived, since at -O0 the package is reloaded through allocas.
+    auto IsPackage = [&](Value *V) {
+        return Prov.derivesFrom(V, PkgArg) || Prov.derivesFromPointerArg(V);
+    };
+    auto IsCurrent = [&](Value *V) { return Prov.readsCurrentVersion(V); };
+
+    for (DomTreeNode *Dom = Node->getIDom(); Dom && Budget.chargeBlocks(); Dom = Dom->getIDom()) {
+        auto *Br = dyn_cast<BranchInst>(Dom->getBlock()->getTerminator());
+        if (!Br || !Br->isConditional()) {
+            continue;
+        }
+
+        // The guard holds on the successor that leads to the install, and
+        // the other successor never gets there.
+        bool Guarded = false;
+        forEachBranchCompare(Br, [&](ICmpInst *Cmp, unsigned SuccIdx, bool Holds) {
+            if (!Guarded && provesNewerVersion(Cmp, Holds, IsPackage, IsCurrent)) {
+                Guarded = Reach.reaches(Br->getSuccessor(SuccIdx), InstallBB) &&
+                          !Reach.reaches(Br->getSuccessor(1 - SuccIdx), InstallBB);
+            }
+        });
+        if (Guarded) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The package a guarded call acts on: its first argument, or for a helper the
+// argument its summary says reaches the install.
+static Value *siteSubject(const RoleCallSite &Site) {
+    CallBase *CB = Site.Call;
+    if (Site.Summary) {
+        int Arg = Site.Summary->InstallArg;
+        if (Arg < 0 || static_cast<unsigned>(Arg) >= CB->arg_size()) {
+            return nullptr;
+        }
+        return CB->getArgOperand(Arg);
+    }
+    return CB->arg_size() != 0 ? CB->getArgOperand(0) : nullptr;
+}
+
+// Successors a branch on Call's result takes when the call returned nonzero:
+// `br (icmp ne %call, 0)`, the `icmp eq` form, the `xor %cmp, true` that
+// -O0 emits for `if (!helper(pkg))`, and the and/or/select forms optimized
+// code folds `&&` and `||` conditions into.
+static void forEachNonZeroSuccessor(CallBase *Call,
+                                    function_ref<void(BasicBlock *, BasicBlock *)> Callback) {
+    using namespace PatternMatch;
+
+    std::vector<std::pair<Value *, bool>> Worklist;
+    if (Call->getType()->isIntegerTy(1)) {
+        Worklist.push_back({Call, true});
+    }
+    for (User *U : Call->users()) {
+        auto *Cmp = dyn_cast<ICmpInst>(U);
+        if (!Cmp) {
+            continue;
+        }
+        ++NumICmpsExamined;
+        if (!Cmp->isEquality()) {
+            continue;
+        }
+        Value *Other = Cmp->getOperand(0) == Call ? Cmp->getOperand(1) : Cmp->getOperand(0);
+        auto *Zero = dyn_cast<ConstantInt>(Other);
+        if (Zero && Zero->isZero()) {
+            Worklist.push_back({Cmp, Cmp->getPredicate() == ICmpInst::ICMP_NE});
+        }
+    }
+
+    while (!Worklist.empty()) {
+        auto [Cond, TrueIfNonZero] = Worklist.back();
+        Worklist.pop_back();
+
+        for (User *U : Cond->users()) {
+            if (auto *Br = dyn_cast<BranchInst>(U)) {
+                if (Br->isConditional() && Br->getSuccessor(0) != Br->getSuccessor(1)) {
+                    Callback(Br->getParent(), Br->getSuccessor(TrueIfNonZero ? 0 : 1));
+                }
+                continue;
+            }
+
+            // A `&&` that holds, or a `||` that fails, says the same of Cond.
+            if (match(U, m_Not(m_Specific(Cond)))) {
+                Worklist.push_back({U, !TrueIfNonZero});
+            } else if (TrueIfNonZero ? match(U, m_LogicalAnd(m_Value(), m_Value()))
+                                     : match(U, m_LogicalOr(m_Value(), m_Value()))) {
+                Worklist.push_back({U, TrueIfNonZero});
+            }
+        }
+    }
+}
+
+// Ordering, provenance and rollback facts for one function, shared by the
+// entry check and by summarizing helpers. When summarizing, the slice also
+// covers every return and each argument gets its own block of role facts, so
+// the summary can say which roles are performed on which argument. The entry
+// check instead gets a fact per package object installed, so a signature
+// verification only counts for the installs of the package it verified.
+class FunctionFacts {
+public:
+    // A point after which a path returns without further calls, and whether
+    // the value it returns may be nonzero.
+    struct ReturnPoint {
+        Instruction *At;
+        bool MayBeNonZero;
+    };
+
+    // Once Budget runs out, only guardedSites() and slice() may be used.
+    FunctionFacts(Function &F, DominatorTree &DT, ArrayRef<RoleCallSite> Sites, bool TrackReturns,
+                  WorkBudget &Budget, PackageObjects *Packages = nullptr)
+        : F(F), DT(DT), Budget(Budget), TrackReturns(TrackReturns), Packages(Packages),
+          Guarded(guardedSitesIn(Sites)),
+          PackageFacts(installedPackages(Packages, Guarded)),
+          PackageFactBase(TrackReturns ? argFactBase(F.arg_size()) : ota::RoleBitCount),
+          NumFacts(PackageFactBase + PackageFacts.size()),
+          Slice(F, sliceSeeds(F, Guarded, TrackReturns), Budget),
+          Reach(F, Slice, Budget),
+          Prov(F, Slice, subjectsOf(Guarded), Budget),
+          Order(F, Slice, NumFacts, Budget) {
+        if (Budget.exhausted()) {
+            return;
+        }
+
+        // All ordering rules are solved together in one pass over the slice;
+        // checks outside it cannot precede any guarded call.
+        for (const RoleCallSite &Site : Sites) {
+            if (!(Site.Roles & orderingRoles()) || !Slice.contains(Site.Call->getParent())) {
+                continue;
+            }
+
+            if (!Site.Summary) {
+                Order.addEvent(Site.Call, factsFor(Site.Call, Site.Roles, {}));
+                continue;
+            }
+
+            const FunctionSummary &Summary = *Site.Summary;
+            Order.addEvent(Site.Call, factsFor(Site.Call, Summary.Always.Roles, Summary.Always.ArgRoles));
+            if (Summary.IfNonZero.Roles != Summary.Always.Roles ||
+                Summary.IfNonZero.ArgRoles != Summary.Always.ArgRoles) {
+                BitVector Gen = factsFor(Site.Call, Summary.IfNonZero.Roles, Summary.IfNonZero.ArgRoles);
+                forEachNonZeroSuccessor(Site.Call, [&](BasicBlock *From, BasicBlock *To) {
+                    Order.addEdgeFacts(From, To, Gen);
+                });
+            }
+        }
+
+        if (TrackReturns) {
+            for (BasicBlock *BB : Slice.blocks()) {
+                if (auto *Ret = dyn_cast<ReturnInst>(BB->getTerminator())) {
+                    addReturnPoints(Ret);
+                }
+            }
+            for (const ReturnPoint &Point : Points) {
+                Order.addEvent(Point.At, BitVector(NumFacts));
+            }
+        }
+        Order.solve();
+    }
+
+    const InstallSlice &slice() const { return Slice; }
+    ArrayRef<RoleCallSite> guardedSites() const { return Guarded; }
+    ArrayRef<ReturnPoint> returnPoints() const { return Points; }
+    const BitVector &factsBefore(const Instruction *I) const { return Order.factsBefore(I); }
+
+    // Roles established on every path to Site, including those a summarized
+    // helper establishes itself before its own installs. Signature
+    // verification of some other package does not count for an install.
+    uint32_t rolesBefore(const RoleCallSite &Site) const {
+        uint32_t Roles = rolesIn(Order.factsBefore(Site.Call));
+        if (Site.Summary) {
+            Roles |= Site.Summary->InstallPrereqs;
+        }
+        if (verifiesOtherPackage(Site)) {
+            Roles &= ~ota::RoleVerify;
+        }
+        return Roles;
+    }
+
+    // Whether every path to the install Site verifies a signature, but not
+    // always of the package Site installs. Installs of a package that cannot
+    // be told apart from others are never reported.
+    bool verifiesOtherPackage(const RoleCallSite &Site) const {
+        if (!(Site.Roles & ota::RoleInstall) ||
+            !(rolesIn(Order.factsBefore(Site.Call)) & ota::RoleVerify) ||
+            (Site.Summary && (Site.Summary->InstallPrereqs & ota::RoleVerify))) {
+            return false;
+        }
+        if (TrackReturns) {
+            int Arg = argumentOf(siteSubject(Site));
+            return Arg >= 0 &&
+                   !(rolesIn(Order.factsBefore(Site.Call), argFactBase(Arg)) & ota::RoleVerify);
+        }
+        int Fact = packageFact(Site);
+        return Fact >= 0 && !Order.factsBefore(Site.Call).test(Fact);
+    }
+
+    // Blocks of a shortest path from the entry to Site that never performs
+    // Role, which must be a single ordering role missing before Site.
+    std::vector<const BasicBlock *> witnessPath(const RoleCallSite &Site, uint32_t Role) const {
+        if (Role == ota::RoleVerify && verifiesOtherPackage(Site)) {
+            int Fact = packageFact(Site);
+            if (Fact >= 0) {
+                return Order.witnessPath(Site.Call, Fact);
+            }
+        }
+        return Order.witnessPath(Site.Call, countTrailingZeros(Role));
+    }
+
+    bool rollbackGuarded(const RoleCallSite &Site) {
+        if (Site.Summary && Site.Summary->InstallsRollbackGuarded) {
+            return true;
+        }
+
+        Value *PkgArg = siteSubject(Site);
+        if (!PkgArg) {
+            return false;
+        }
+
+        // Installs in the same block on the same package share one guard search.
+        BasicBlock *InstallBB = Site.Call->getParent();
+        PkgArg = PkgArg->stripPointerCasts();
+        auto Cached = RollbackGuards.try_emplace({InstallBB, PkgArg}, false);
+        if (Cached.second) {
+            Cached.first->second =
+                hasRollbackGuardBeforeInstall(DT, Reach, Prov, Budget, InstallBB, PkgArg);
+        }
+        return Cached.first->second;
+    }
+
+    // Index of the one argument V derives from, or -1.
+    int argumentOf(Value *V) const {
+        int Found = -1;
+        for (Argument &A : F.args()) {
+            if (!Prov.derivesFrom(V, &A)) {
+                continue;
+            }
+            if (Found >= 0) {
+                return -1;
+            }
+            Found = A.getArgNo();
+        }
+        return Found;
+    }
+
+private:
+    // A fact index for each distinct known package the installs act on.
+    static DenseMap<Value *, unsigned> installedPackages(PackageObjects *Packages,
+                                                         ArrayRef<RoleCallSite> Guarded) {
+        DenseMap<Value *, unsigned> Facts;
+        if (!Packages) {
+            return Facts;
+        }
+        for (const RoleCallSite &Site : Guarded) {
+            Value *Subject = (Site.Roles & ota::RoleInstall) ? siteSubject(Site) : nullptr;
+            if (Value *Object = Subject ? Packages->objectOf(Subject) : nullptr) {
+                Facts.try_emplace(Object, Facts.size());
+            }
+        }
+        return Facts;
+    }
+
+    int packageFact(const RoleCallSite &Site) const {
+        Value *Subject = Packages ? siteSubject(Site) : nullptr;
+        auto It = Subject ? PackageFacts.find(Packages->objectOf(Subject)) : PackageFacts.end();
+        return It == PackageFacts.end() ? -1 : static_cast<int>(PackageFactBase + It->second);
+    }
+
+    static std::vector<RoleCallSite> guardedSitesIn(ArrayRef<RoleCallSite> Sites) {
+        std::vector<RoleCallSite> Guarded;
+        for (const RoleCallSite &Site : Sites) {
+            if (Site.Roles & guardedRoles()) {
+                Guarded.push_back(Site);
+            }
+        }
+        return Guarded;
+    }
+
+    static std::vector<Instruction *> sliceSeeds(Function &F, ArrayRef<RoleCallSite> Guarded,
+                                                 bool TrackReturns) {
+        std::vector<Instruction *> Seeds;
+        for (const RoleCallSite &Site : Guarded) {
+            Seeds.push_back(Site.Call);
+        }
+        if (TrackReturns) {
+            for (BasicBlock &BB : F) {
+                if (auto *Ret = dyn_cast<ReturnInst>(BB.getTerminator())) {
+                    Seeds.push_back(Ret);
+                }
+            }
+        }
+        return Seeds;
+    }
+
+    static std::vector<Value *> subjectsOf(ArrayRef<RoleCallSite> Guarded) {
+        std::vector<Value *> Subjects;
+        for (const RoleCallSite &Site : Guarded) {
+            if (Site.Roles & ota::RoleInstall) {
+                Subjects.push_back(siteSubject(Site));
+            }
+        }
+        return Subjects;
+    }
+
+    static bool mayBeNonZero(Value *V) {
+        auto *C = dyn_cast<ConstantInt>(V);
+        return !C || !C->isZero();
+    }
+
+    // Where each path through Ret fixes its return value. At -O0 that is the
+    // store to the return-value slot; after mem2reg, the PHI's incoming edge.
+    void addReturnPoints(ReturnInst *Ret) {
+        Value *V = Ret->getReturnValue();
+        if (!V) {
+            Points.push_back({Ret, true});
+            return;
+        }
+
+        if (auto *PHI = dyn_cast<PHINode>(V)) {
+            if (PHI->getParent() == Ret->getParent()) {
+                for (unsigned Idx = 0, E = PHI->getNumIncomingValues(); Idx != E; ++Idx) {
+                    BasicBlock *Pred = PHI->getIncomingBlock(Idx);
+                    if (Slice.contains(Pred)) {
+                        Points.push_back({Pred->getTerminator(), mayBeNonZero(PHI->getIncomingValue(Idx))});
+                    }
+                }
+                return;
+            }
+        }
+
+        auto *LI = dyn_cast<LoadInst>(V);
+        auto *Slot = LI ? dyn_cast<AllocaInst>(LI->getPointerOperand()) : nullptr;
+        if (Slot && llvm::all_of(Slot->users(), [&](User *U) {
+                auto *SI = dyn_cast<StoreInst>(U);
+                return isa<LoadInst>(U) || (SI && SI->getPointerOperand() == Slot);
+            })) {
+            for (User *U : Slot->users()) {
+                auto *SI = dyn_cast<StoreInst>(U);
+                if (SI && Slice.contains(SI->getParent())) {
+                    Points.push_back({SI, mayBeNonZero(SI->getValueOperand())});
+                }
+            }
+            return;
+        }
+
+        Points.push_back({Ret, mayBeNonZero(V)});
+    }
+
+    // Verifying a known package establishes its fact; verifying something
+    // unknown, or in a helper that does not say what, may be of any package.
+    void addVerifiedPackages(CallBase *CB, uint32_t Roles, ArrayRef<uint32_t> ArgRoles,
+                             BitVector &Gen) const {
+        if (PackageFacts.empty() || !(Roles & ota::RoleVerify)) {
+            return;
+        }
+
+        SmallVector<Value *, 2> Verified;
+        if (ArgRoles.empty() && CB->arg_size() != 0) {
+            Verified.push_back(CB->getArgOperand(0));
+        }
+        unsigned NumArgs = std::min<unsigned>(ArgRoles.size(), CB->arg_size());
+        for (unsigned Idx = 0; Idx != NumArgs; ++Idx) {
+            if (ArgRoles[Idx] & ota::RoleVerify) {
+                Verified.push_back(CB->getArgOperand(Idx));
+            }
+        }
+        if (Verified.empty()) {
+            Gen.set(PackageFactBase, NumFacts);
+            return;
+        }
+
+        for (Value *V : Verified) {
+            Value *Object = Packages->objectOf(V);
+            if (!Object) {
+                Gen.set(PackageFactBase, NumFacts);
+                return;
+            }
+            auto It = PackageFacts.find(Object);
+            if (It != PackageFacts.end()) {
+                Gen.set(PackageFactBase + It->second);
+            }
+        }
+    }
+
+    BitVector factsFor(CallBase *CB, uint32_t Roles, ArrayRef<uint32_t> ArgRoles) const {
+        BitVector Gen = roleFacts(Roles, NumFacts);
+        addVerifiedPackages(CB, Roles, ArgRoles, Gen);
+        if (!TrackReturns) {
+            return Gen;
+        }
+
+        auto AddArgFacts = [&](Value *Actual, uint32_t Roles) {
+            for (Argument &A : F.args()) {
+                if (!Prov.derivesFrom(Actual, &A)) {
                     continue;
                 }
+                for (unsigned Bit = 0; Bit != ota::RoleBitCount; ++Bit) {
+                    if (Roles & (1u << Bit)) {
+                        Gen.set(argFactBase(A.getArgNo()) + Bit);
+                    }
+                }
+            }
+        };
+
+        // A named callee acts on its first argument; a helper on whichever
+        // arguments its summary names.
+        if (ArgRoles.empty() && CB->arg_size() != 0) {
+            AddArgFacts(CB->getArgOperand(0), Roles);
+        }
+        unsigned NumArgs = std::min<unsigned>(ArgRoles.size(), CB->arg_size());
+        for (unsigned Idx = 0; Idx != NumArgs; ++Idx) {
+            AddArgFacts(CB->getArgOperand(Idx), ArgRoles[Idx]);
+        }
+        return Gen;
+    }
+
+    Function &F;
+    DominatorTree &DT;
+    WorkBudget &Budget;
+    bool TrackReturns;
+    PackageObjects *Packages;
+    std::vector<RoleCallSite> Guarded;
+    DenseMap<Value *, unsigned> PackageFacts;
+    unsigned PackageFactBase;
+    unsigned NumFacts;
+    InstallSlice Slice;
+    BlockReachability Reach;
+    ValueProvenance Prov;
+    MustPrecedeDataflow Order;
+    std::vector<ReturnPoint> Points;
+    DenseMap<std::pair<BasicBlock *, Value *>, bool> RollbackGuards;
+};
+
+// Shallow stand-ins for ValueProvenance in the conservative check: a few
+// loads, GEPs, casts and stores into allocas, and no PHIs or selects.
+static constexpr unsigned ShallowProvenanceSteps = 64;
+
+static bool shallowDerivesFromPackage(Value *V, Value *Pkg, unsigned &Steps) {
+    V = V->stripPointerCasts();
+    if (V == Pkg || (isa<Argument>(V) && V->getType()->isPointerTy())) {
+        return true;
+    }
+    if (++Steps > ShallowProvenanceSteps) {
+        return false;
+    }
+
+    if (auto *LI = dyn_cast<LoadInst>(V)) {
+        return shallowDerivesFromPackage(LI->getPointerOperand(), Pkg, Steps);
+    }
+    if (auto *GEP = dyn_cast<GetElementPtrInst>(V)) {
+        return shallowDerivesFromPackage(GEP->getPointerOperand(), Pkg, Steps);
+    }
+    if (auto *Cast = dyn_cast<CastInst>(V)) {
+        return shallowDerivesFromPackage(Cast->getOperand(0), Pkg, Steps);
+    }
+    if (auto *AI = dyn_cast<AllocaInst>(V)) {
+        for (User *U : AI->users()) {
+            auto *SI = dyn_cast<StoreInst>(U);
+            if (SI && SI->getPointerOperand() == AI &&
+                shallowDerivesFromPackage(SI->getValueOperand(), Pkg, Steps)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool shallowReadsCurrentVersion(Value *V) {
+    for (unsigned Step = 0; Step != ShallowProvenanceSteps; ++Step) {
+        V = V->stripPointerCasts();
+        if (auto *GV = dyn_cast<GlobalVariable>(V)) {
+            return GV->getName() == "current_version";
+        }
+        if (auto *LI = dyn_cast<LoadInst>(V)) {
+            V = LI->getPointerOperand();
+        } else if (auto *GEP = dyn_cast<GetElementPtrInst>(V)) {
+            V = GEP->getPointerOperand();
+        } else if (auto *Cast = dyn_cast<CastInst>(V)) {
+            V = Cast->getOperand(0);
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+// A compare of the package's version against current_version, tested by the
+// branch of a dominator of InstallBB on an edge that dominates InstallBB.
+static bool hasDominatingRollbackGuard(DominatorTree &DT, BasicBlock *InstallBB, Value *Pkg) {
+    DomTreeNode *Node = DT.getNode(InstallBB);
+    if (!Node) {
+        return false;
+    }
+
+    // The shallow walks share one step cap per compare.
+    unsigned Steps = 0;
+    auto IsPackage = [&](Value *V) { return shallowDerivesFromPackage(V, Pkg, Steps); };
+    auto IsCurrent = [](Value *V) { return shallowReadsCurrentVersion(V); };
+
+    for (DomTreeNode *Dom = Node->getIDom(); Dom; Dom = Dom->getIDom()) {
+        auto *Br = dyn_cast<BranchInst>(Dom->getBlock()->getTerminator());
+        if (!Br || !Br->isConditional() || Br->getSuccessor(0) == Br->getSuccessor(1)) {
+            continue;
+        }
+
+        bool Guarded = false;
+        forEachBranchCompare(Br, [&](ICmpInst *Cmp, unsigned SuccIdx, bool Holds) {
+            Steps = 0;
+            if (!Guarded && provesNewerVersion(Cmp, Holds, IsPackage, IsCurrent)) {
+                Guarded = DT.dominates(BasicBlockEdge(Dom->getBlock(), Br->getSuccessor(SuccIdx)),
+                                       InstallBB);
+            }
+        });
+        if (Guarded) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Prerequisite roles a call performs whatever it returns.
+static uint32_t rolesPerformedBy(const RoleCallSite &Site) {
+    return Site.Summary ? Site.Summary->Always.Roles : Site.Roles;
+}
+
+// The check for a function that ran out of budget: only what dominates a
+// guarded call counts. A prerequisite must be performed by a call in a
+// dominating block, or earlier in the call's own block, and the rollback guard
+// must sit on a branch edge that dominates it. One walk up the dominator tree
+// per guarded call; it can reject code the full analysis accepts.
+static std::vector<ota::GuardedSiteStatus>
+conservativeSiteStatuses(DominatorTree &DT, ArrayRef<RoleCallSite> Sites,
+                         ArrayRef<RoleCallSite> Guarded) {
+    DenseMap<const BasicBlock *, SmallVector<const RoleCallSite *, 2>> Performing;
+    for (const RoleCallSite &Site : Sites) {
+        if (rolesPerformedBy(Site) & orderingRoles()) {
+            Performing[Site.Call->getParent()].push_back(&Site);
+        }
+    }
+
+    std::vector<ota::GuardedSiteStatus> Statuses;
+    for (const RoleCallSite &Site : Guarded) {
+        BasicBlock *BB = Site.Call->getParent();
+        uint32_t Before = Site.Summary ? Site.Summary->InstallPrereqs : ota::RoleNone;
+        for (DomTreeNode *Node = DT.getNode(BB); Node; Node = Node->getIDom()) {
+            auto It = Performing.find(Node->getBlock());
+            if (It == Performing.end()) {
+                continue;
+            }
+            for (const RoleCallSite *Prior : It->second) {
+                if (Node->getBlock() != BB || Prior->Call->comesBefore(Site.Call)) {
+                    Before |= rolesPerformedBy(*Prior) & orderingRoles();
+                }
+            }
+        }
+
+        Value *Subject = siteSubject(Site);
+        bool RollbackGuarded = false;
+        if (Site.Roles & ota::RoleInstall) {
+            RollbackGuarded = (Site.Summary && Site.Summary->InstallsRollbackGuarded) ||
+                              (Subject && hasDominatingRollbackGuard(DT, BB, Subject->stripPointerCasts()));
+        }
+        auto *Arg = dyn_cast_or_null<Argument>(Subject ? Subject->stripPointerCasts() : nullptr);
+        Statuses.push_back({Site.Call, Site.Roles, Before, Subject,
+                            Arg ? static_cast<int>(Arg->getArgNo()) : -1, RollbackGuarded});
+    }
+    return Statuses;
+}
+
+// Adds the overruns not yet in To, one per function.
+static void appendOverruns(std::vector<ota::BudgetOverrun> &To,
+                           ArrayRef<ota::BudgetOverrun> From) {
+    for (const ota::BudgetOverrun &Overrun : From) {
+        if (llvm::none_of(To, [&](const ota::BudgetOverrun &Known) {
+                return Known.Function == Overrun.Function;
+            })) {
+            To.push_back(Overrun);
+        }
+    }
+}
+
+// Each block is named by its label, or by its position in F when it has none,
+// and placed at its first source line.
+static std::vector<ota::WitnessStep> witnessSteps(const Function &F,
+                                                  ArrayRef<const BasicBlock *> Path) {
+    DenseMap<const BasicBlock *, unsigned> Position;
+    for (const BasicBlock &BB : F) {
+        Position[&BB] = Position.size();
+    }
+
+    std::vector<ota::WitnessStep> Steps;
+    for (const BasicBlock *BB : Path) {
+        ota::WitnessStep Step;
+        Step.Block = BB->hasName() ? BB->getName().str() : "bb" + std::to_string(Position[BB]);
+        for (const Instruction &I : *BB) {
+            const DILocation *Loc = I.getDebugLoc().get();
+            if (Loc && Loc->getLine() != 0) {
+                Step.File = Loc->getFilename().str();
+                Step.Line = Loc->getLine();
+                break;
+            }
+        }
+        Steps.push_back(std::move(Step));
+    }
+    return Steps;
+}
+
+// Time spent in each phase of one function's check, for -ota-timing-json.
+// A phase entered more than once, such as the rollback search per install,
+// accumulates.
+struct FunctionTiming {
+    std::string Module;
+    std::string Function;
+    double TotalSeconds = 0;
+    std::vector<std::pair<const char *, double>> PhaseSeconds;
+};
+
+// Filled by checks on every thread and written out by the passes.
+static std::mutex TimingLogMutex;
+
+static std::vector<FunctionTiming> &timingLog() {
+    static std::vector<FunctionTiming> Log;
+    return Log;
+}
+
+// One phase of a function's check: a region under -ftime-trace (worker threads
+// of traversal-module-pass have no profiler and skip it), and a timed entry in
+// the function's record when one is kept.
+class RulePhase {
+public:
+    RulePhase(FunctionTiming *Timing, const char *Name, const Function &F)
+        : Trace(Name, F.getName()), Timing(Timing), Name(Name), Start(Clock::now()) {}
+
+    ~RulePhase() {
+        if (!Timing) {
+            return;
+        }
+        double Elapsed = std::chrono::duration<double>(Clock::now() - Start).count();
+        for (auto &Phase : Timing->PhaseSeconds) {
+            if (Phase.first == Name) {
+                Phase.second += Elapsed;
+                return;
+            }
+        }
+        Timing->PhaseSeconds.push_back({Name, Elapsed});
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    TimeTraceScope Trace;
+    FunctionTiming *Timing;
+    const char *Name;
+    Clock::time_point Start;
+};
+
+// Rewritten with every record so far, like the SARIF log.
+static void writeTimingLog() {
+    if (TimingJsonPath.empty()) {
+        return;
+    }
+
+    std::error_code EC;
+    raw_fd_ostream OS(TimingJsonPath, EC, sys::fs::OF_Text);
+    if (EC) {
+        report_fatal_error(Twine("[OTA Security Pass] cannot write timing log '") + TimingJsonPath +
+                               "': " + EC.message(),
+                           false);
+    }
+
+    // The counters go in too: a release build of LLVM does not print them
+    // under -stats.
+    const TrackingStatistic *Counters[] = {&NumFunctionsChecked, &NumCallSitesClassified,
+                                           &NumICmpsExamined, &NumBFSNodesVisited,
+                                           &NumProvenanceSteps};
+
+    std::lock_guard<std::mutex> Lock(TimingLogMutex);
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attributeObject("statistics", [&] {
+            for (const TrackingStatistic *Counter : Counters) {
+                J.attribute(Counter->getName(), Counter->getValue());
+            }
+        });
+        J.attributeArray("functions", [&] {
+            for (const FunctionTiming &Timing : timingLog()) {
+                J.object([&] {
+                    J.attribute("module", Timing.Module);
+                    J.attribute("function", Timing.Function);
+                    J.attribute("total_ms", Timing.TotalSeconds * 1000);
+                    J.attributeObject("phases_ms", [&] {
+                        for (const auto &Phase : Timing.PhaseSeconds) {
+                            J.attribute(Phase.first, Phase.second * 1000);
+                        }
+                    });
+                });
+            }
+        });
+    });
+    OS << "\n";
+}
+
+// Runs every rule on one entry function. Everything it builds is local to the
+// call, so checks of different functions can run on different threads as long
+// as each gets its own dominator tree, MemorySSA and alias analysis.
+static ota::PolicyResult checkFunction(Function &F, DominatorTree &DT, MemorySSA &MSSA,
+                                       AAResults &AA, const SecurityCallSiteIndex &Sites) {
+    ++NumFunctionsChecked;
+    ota::PolicyResult Result;
+    std::vector<ota::PolicyViolation> &Violations = Result.Violations;
+
+    std::unique_ptr<FunctionTiming> Timing;
+    if (!TimingJsonPath.empty()) {
+        Timing = std::make_unique<FunctionTiming>();
+        Timing->Module = F.getParent()->getModuleIdentifier();
+        Timing->Function = F.getName().str();
+    }
+    auto Start = std::chrono::steady_clock::now();
+    TimeTraceScope Trace("ota-check-function", F.getName());
+
+    Optional<RulePhase> CallSitePhase;
+    CallSitePhase.emplace(Timing.get(), "call-site-rules", F);
+    for (const RoleCallSite &Site : Sites.callSitesIn(F)) {
+        Result.CallSites.push_back({Site.Call, Site.Roles, Site.Summary != nullptr});
+
+        CallBase *CI = Site.Call;
+        uint32_t Roles = Site.Roles;
+        StringRef Name = CI->getCalledFunction()->getName();
+
+        if (Roles & orderingRoles()) {
+            continue;
+        }
+
+        if (Roles & ota::RoleSensitiveLogging) {
+            Violations.push_back(violationAt("ota-sensitive-logging", F, CI,
+                                             "Sensitive logging API call inside " +
+                                                 F.getName().str() + "(): " + Name.str()));
+            continue;
+        }
+
+        if (Roles & ota::RoleWeakCrypto) {
+            Violations.push_back(violationAt("ota-weak-crypto", F, CI,
+                                             "Weak crypto or weak entropy API inside " +
+                                                 F.getName().str() + "(): " + Name.str()));
+            continue;
+        }
+
+        if (Roles & ota::RoleBanned) {
+            Violations.push_back(violationAt("ota-banned-api", F, CI,
+                                             "Banned API call inside " + F.getName().str() +
+                                                 "(): " + Name.str() + " (deny-list entry '" +
+                                                 bannedApiList()->match(Name).str() + "')"));
+        }
+    }
+    CallSitePhase.reset();
+
+    WorkBudget Budget(F);
+    Optional<RulePhase> FactsPhase;
+    FactsPhase.emplace(Timing.get(), "ordering-facts", F);
+    PackageObjects Packages(MSSA, AA, Budget);
+    FunctionFacts Facts(F, DT, Sites.callSitesIn(F), /*TrackReturns=*/false, Budget, &Packages);
+    FactsPhase.reset();
+    if (ReportSlice && !Budget.exhausted()) {
+        errs() << "[OTA Security Pass] " << F.getName() << ": install slice "
+               << Facts.slice().size() << " of " << F.size() << " blocks\n";
+    }
+
+    for (const RoleCallSite &Site : Facts.guardedSites()) {
+        if (Budget.exhausted()) {
+            break;
+        }
+        uint32_t Before = Facts.rolesBefore(Site);
+        Value *Subject = siteSubject(Site);
+        bool RollbackGuarded = false;
+        if (Site.Roles & ota::RoleInstall) {
+            RulePhase Phase(Timing.get(), "rollback-guard", F);
+            RollbackGuarded = Facts.rollbackGuarded(Site);
+        }
+        Result.GuardedSites.push_back({Site.Call, Site.Roles, Before, Subject,
+                                       Subject ? Facts.argumentOf(Subject) : -1, RollbackGuarded});
+    }
+
+    bool Conservative = Budget.exhausted();
+    if (Conservative) {
+        RulePhase Phase(Timing.get(), "conservative-check", F);
+        Result.GuardedSites = conservativeSiteStatuses(DT, Sites.callSitesIn(F), Facts.guardedSites());
+        Result.Overruns.push_back(*Budget.overrun());
+    }
+    for (const RoleCallSite &Site : Sites.callSitesIn(F)) {
+        if (Site.Summary) {
+            appendOverruns(Result.Overruns, Site.Summary->Overruns);
+        }
+    }
+
+    // GuardedSites lines up with Facts.guardedSites(), which the witness
+    // search needs; a conservative verdict has no witness.
+    for (size_t Idx = 0, E = Result.GuardedSites.size(); Idx != E; ++Idx) {
+        const ota::GuardedSiteStatus &Status = Result.GuardedSites[Idx];
+        RulePhase Phase(Timing.get(), "ordering-rules", F);
+        for (const OrderingRule &Rule : OrderingRules) {
+            if (!(Status.Roles & Rule.GuardedRole) || (Status.RolesBefore & Rule.PrerequisiteRole)) {
+                continue;
+            }
+            if (Conservative) {
+                Violations.push_back(violationAt(Rule.RuleId, F, Status.Call,
+                                                 std::string(Rule.Message) + " (conservative check)"));
+                continue;
+            }
+            const RoleCallSite &Site = Facts.guardedSites()[Idx];
+            Violations.push_back(violationAt(Rule.RuleId, F, Status.Call,
+                                             Rule.PrerequisiteRole == ota::RoleVerify &&
+                                                     Facts.verifiesOtherPackage(Site)
+                                                 ? "Install call is preceded by signature "
+                                                   "verification of a different package"
+                                                 : Rule.Message));
+            Violations.back().Witness =
+                witnessSteps(F, Facts.witnessPath(Site, Rule.PrerequisiteRole));
+        }
+
+        if ((Status.Roles & ota::RoleInstall) && !Status.RollbackGuarded) {
+            std::string Message =
+                "Rollback guard '(new_version > current_version)' does not gate install path";
+            if (Conservative) {
+                Message += " (conservative check)";
+            }
+            Violations.push_back(violationAt("ota-rollback-guard", F, Status.Call, Message));
+        }
+    }
+
+    if (Timing) {
+        Timing->TotalSeconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+        std::lock_guard<std::mutex> Lock(TimingLogMutex);
+        timingLog().push_back(std::move(*Timing));
+    }
+    return Result;
+}
+
+static std::vector<RoleCallSite> classifyCallsIn(Function &F, const FunctionSummaries &Summaries) {
+    std::vector<RoleCallSite> Sites;
+    for (Instruction &I : instructions(F)) {
+        auto *CB = dyn_cast<CallBase>(&I);
+        Function *Callee = CB ? CB->getCalledFunction() : nullptr;
+        if (!Callee) {
+            continue;
+        }
+
+        auto [Roles, Summary] = classifyCallee(*Callee, Summaries);
+        if (Roles != ota::RoleNone) {
+            Sites.push_back({CB, Roles, Summary});
+        }
+    }
+    NumCallSitesClassified += Sites.size();
+    return Sites;
+}
+
+// Meets the facts before each return point into Roles, starting from "all
+// roles" so an empty set of points leaves the caller to decide.
+static bool meetReturnFacts(const FunctionFacts &Facts, unsigned NumArgs, bool NonZeroOnly,
+                            SummaryRoles &Roles) {
+    Roles.Roles = ~0u;
+    Roles.ArgRoles.assign(NumArgs, ~0u);
+
+    bool Any = false;
+    for (const FunctionFacts::ReturnPoint &Point : Facts.returnPoints()) {
+        if (NonZeroOnly && !Point.MayBeNonZero) {
+            continue;
+        }
+        const BitVector &Before = Facts.factsBefore(Point.At);
+        Roles.Roles &= rolesIn(Before);
+        for (unsigned Idx = 0; Idx != NumArgs; ++Idx) {
+            Roles.ArgRoles[Idx] &= rolesIn(Before, argFactBase(Idx));
+        }
+        Any = true;
+    }
+
+    // Guarded roles inside a helper are tracked through MayInstall instead.
+    Roles.Roles &= ~guardedRoles();
+    for (uint32_t &ArgRoles : Roles.ArgRoles) {
+        ArgRoles &= ~guardedRoles();
+    }
+    return Any;
+}
+
+// What a helper that ran out of budget promises its callers: nothing, except
+// that it may install.
+static FunctionSummary conservativeSummary(const Function &F, ArrayRef<RoleCallSite> Guarded) {
+    FunctionSummary Summary;
+    Summary.Always.ArgRoles.assign(F.arg_size(), ota::RoleNone);
+    Summary.IfNonZero = Summary.Always;
+    Summary.MayInstall = llvm::any_of(
+        Guarded, [](const RoleCallSite &Site) { return Site.Roles & ota::RoleInstall; });
+    return Summary;
+}
+
+// The summary of F from its own body; a helper that runs out of budget gets
+// the conservative one.
+static FunctionSummary summarizeWithin(Function &F, DominatorTree &DT,
+                                       ArrayRef<RoleCallSite> Sites) {
+    WorkBudget Budget(F);
+    FunctionFacts Facts(F, DT, Sites, /*TrackReturns=*/true, Budget);
+    if (Budget.exhausted()) {
+        FunctionSummary Summary = conservativeSummary(F, Facts.guardedSites());
+        Summary.Overruns.push_back(*Budget.overrun());
+        return Summary;
+    }
+
+    // A function that never returns does nothing for its callers, and one that
+    // never returns nonzero promises nothing beyond what it always does.
+    FunctionSummary Summary;
+    if (!meetReturnFacts(Facts, F.arg_size(), /*NonZeroOnly=*/false, Summary.Always)) {
+        Summary.Always.Roles = ota::RoleNone;
+        Summary.Always.ArgRoles.assign(F.arg_size(), ota::RoleNone);
+    }
+    if (!meetReturnFacts(Facts, F.arg_size(), /*NonZeroOnly=*/true, Summary.IfNonZero)) {
+        Summary.IfNonZero = Summary.Always;
+    }
+
+    for (const RoleCallSite &Site : Facts.guardedSites()) {
+        if (!(Site.Roles & ota::RoleInstall)) {
+            continue;
+        }
+
+        int Arg = Facts.argumentOf(siteSubject(Site));
+        bool Guarded = Facts.rollbackGuarded(Site);
+        if (!Summary.MayInstall) {
+            Summary.MayInstall = true;
+            Summary.InstallPrereqs = Facts.rolesBefore(Site);
+            Summary.InstallArg = Arg;
+            Summary.InstallsRollbackGuarded = Guarded;
+            continue;
+        }
+
+        Summary.InstallPrereqs &= Facts.rolesBefore(Site);
+        if (Summary.InstallArg != Arg) {
+            Summary.InstallArg = -1;
+        }
+        Summary.InstallsRollbackGuarded &= Guarded;
+    }
+
+    // The rollback searches may have run out of budget too.
+    if (Budget.exhausted()) {
+        Summary = conservativeSummary(F, Facts.guardedSites());
+        Summary.Overruns.push_back(*Budget.overrun());
+    }
+    return Summary;
+}
+
+// Also carries the overruns of the helpers F calls, since its summary
+// inherits their conservative answers.
+static FunctionSummary summarizeFunction(Function &F, DominatorTree &DT,
+                                         ArrayRef<RoleCallSite> Sites) {
+    FunctionSummary Summary = summarizeWithin(F, DT, Sites);
+    for (const RoleCallSite &Site : Sites) {
+        if (Site.Summary) {
+            appendOverruns(Summary.Overruns, Site.Summary->Overruns);
+        }
+    }
+    return Summary;
+}
+
+static FunctionSummary summaryFromDatabase(const ota::SummaryDatabase::Entry &Stored) {
+    FunctionSummary Summary;
+    Summary.Always.Roles = Stored.alwaysRoles();
+    Summary.Always.ArgRoles.assign(Stored.alwaysArgRoles().begin(), Stored.alwaysArgRoles().end());
+    Summary.IfNonZero.Roles = Stored.ifNonZeroRoles();
+    Summary.IfNonZero.ArgRoles.assign(Stored.ifNonZeroArgRoles().begin(),
+                                      Stored.ifNonZeroArgRoles().end());
+    Summary.MayInstall = Stored.mayInstall();
+    Summary.InstallPrereqs = Stored.installPrereqs();
+    Summary.InstallArg = Stored.installArg();
+    Summary.InstallsRollbackGuarded = Stored.installsRollbackGuarded();
+    return Summary;
+}
+
+// A summary that makes calls to F carry Roles, acting on the first argument
+// as a callee from the role table does.
+static FunctionSummary summaryOfRoles(const Function &F, uint32_t Roles) {
+    FunctionSummary Summary;
+    Summary.Always.Roles = Roles & ~ota::RoleInstall;
+    Summary.IfNonZero.Roles = Summary.Always.Roles;
+    Summary.MayInstall = Roles & ota::RoleInstall;
+    Summary.InstallArg = F.arg_empty() ? -1 : 0;
+    return Summary;
+}
+
+static ota::SymbolSummary summaryForDatabase(const Function &F, const FunctionSummary &Summary) {
+    ota::SymbolSummary Stored;
+    Stored.Name = F.getName().str();
+    Stored.AlwaysRoles = Summary.Always.Roles;
+    Stored.IfNonZeroRoles = Summary.IfNonZero.Roles;
+    Stored.InstallPrereqs = Summary.InstallPrereqs;
+    Stored.MayInstall = Summary.MayInstall;
+    Stored.InstallsRollbackGuarded = Summary.InstallsRollbackGuarded;
+    Stored.InstallArg = Summary.InstallArg;
+    Stored.AlwaysArgRoles.assign(Summary.Always.ArgRoles.begin(), Summary.Always.ArgRoles.end());
+    Stored.IfNonZeroArgRoles.assign(Summary.IfNonZero.ArgRoles.begin(),
+                                    Summary.IfNonZero.ArgRoles.end());
+    return Stored;
+}
+
+// The functions some roots reach through direct calls, as a graph that
+// scc_iterator walks bottom-up. A synthetic node calls every root, like
+// CallGraph's external calling node. Only the bodies of reached functions are
+// read, so summarizing for one entry point does not scan the whole module, and
+// unlike CallGraph nothing registers value handles in the LLVMContext.
+class DirectCallGraph {
+public:
+    struct Node {
+        Function *F = nullptr;
+        std::vector<Node *> Callees;
+    };
+
+    explicit DirectCallGraph(ArrayRef<Function *> Roots) {
+        Nodes.emplace_back();
+        for (Function *Root : Roots) {
+            Nodes.front().Callees.push_back(nodeFor(Root));
+        }
+        // Nodes grows while it is walked; a deque keeps references stable.
+        for (size_t Idx = 1; Idx < Nodes.size(); ++Idx) {
+            Node &N = Nodes[Idx];
+            for (Instruction &I : instructions(*N.F)) {
+                auto *CB = dyn_cast<CallBase>(&I);
+                if (Function *Callee = CB ? CB->getCalledFunction() : nullptr) {
+                    N.Callees.push_back(nodeFor(Callee));
+                    Called.insert(Callee);
+                }
+            }
+        }
+    }
+
+    Node *root() { return &Nodes.front(); }
+
+    // Whether F is called by a reached function, not just a root.
+    bool isCalled(const Function *F) const { return Called.count(F); }
+
+private:
+    Node *nodeFor(Function *F) {
+        auto Inserted = NodeOf.try_emplace(F, nullptr);
+        if (Inserted.second) {
+            Nodes.emplace_back();
+            Nodes.back().F = F;
+            Inserted.first->second = &Nodes.back();
+        }
+        return Inserted.first->second;
+    }
+
+    std::deque<Node> Nodes;
+    DenseMap<const Function *, Node *> NodeOf;
+    SmallPtrSet<const Function *, 32> Called;
+};
+
+} // namespace
+
+namespace llvm {
+template <> struct GraphTraits<DirectCallGraph::Node *> {
+    using NodeRef = DirectCallGraph::Node *;
+    using ChildIteratorType = std::vector<NodeRef>::iterator;
+
+    static NodeRef getEntryNode(NodeRef N) { return N; }
+    static ChildIteratorType child_begin(NodeRef N) { return N->Callees.begin(); }
+    static ChildIteratorType child_end(NodeRef N) { return N->Callees.end(); }
+};
+} // namespace llvm
+
+namespace {
+
+// Summaries of every defined function the roots can call, computed bottom-up
+// over the SCCs of their direct calls so each callee is summarized before its
+// callers. Every function is summarized once however many call sites it has.
+// Declarations are looked up in the summary database, if one is given.
+static FunctionSummaries summarizeModule(Module &M, const ota::AnnotatedRoles &Annotations,
+                                         ArrayRef<Function *> Roots, bool SummarizeRoots = false) {
+    TimeTraceScope Trace("ota-summarize", M.getName());
+    FunctionSummaries Summaries(Annotations);
+    DirectCallGraph CG(Roots);
+    const ota::SummaryDatabase *Database = summaryDatabase();
+
+    for (scc_iterator<DirectCallGraph::Node *> It = scc_begin(CG.root()); !It.isAtEnd(); ++It) {
+        SmallVector<Function *, 4> Members;
+        for (DirectCallGraph::Node *Node : *It) {
+            Function *G = Node->F;
+            if (!G || (!SummarizeRoots && !CG.isCalled(G)) ||
+                calleeRoles(*G, Annotations) != ota::RoleNone) {
+                continue;
+            }
+
+            if (!G->isDeclaration()) {
+                Members.push_back(G);
+            } else if (Database) {
+                if (Optional<ota::SummaryDatabase::Entry> Stored = Database->lookup(G->getName())) {
+                    Summaries.insert(*G, summaryFromDatabase(*Stored));
+                }
+            }
+        }
+
+        for (Function *G : Members) {
+            DominatorTree DT(*G);
+            FunctionSummary Summary = summarizeFunction(*G, DT, classifyCallsIn(*G, Summaries));
+            if (Summary.callSiteRoles() != ota::RoleNone) {
+                Summaries.insert(*G, std::move(Summary));
+            }
+        }
+
+        // Calls inside a recursive SCC were classified before their callee had
+        // a summary. If any member installs, any of them may reach it, with
+        // nothing known about what precedes the install.
+        if (!It.hasCycle()) {
+            continue;
+        }
+        bool AnyInstall = llvm::any_of(Members, [&](Function *G) {
+            const FunctionSummary *Summary = Summaries.lookup(*G);
+            return Summary && Summary->MayInstall;
+        });
+        if (!AnyInstall) {
+            continue;
+        }
+        for (Function *G : Members) {
+            const FunctionSummary *Known = Summaries.lookup(*G);
+            FunctionSummary Summary = Known ? *Known : FunctionSummary();
+            Summary.MayInstall = true;
+            Summary.InstallPrereqs = ota::RoleNone;
+            Summary.InstallArg = -1;
+            Summary.InstallsRollbackGuarded = false;
+            Summaries.insert(*G, std::move(Summary));
+        }
+    }
+
+    return Summaries;
+}
+
+static void hashInt(SHA256 &Hash, uint64_t V) {
+    uint8_t Bytes[8];
+    support::endian::write64le(Bytes, V);
+    Hash.update(Bytes);
+}
+
+static void hashString(SHA256 &Hash, StringRef S) {
+    hashInt(Hash, S.size());
+    Hash.update(S);
+}
+
+// Everything an entry's verdict depends on: the plugin and policy versions,
+// the role table, the ordering rules and the deny list, then the code of the
+// entry and of every function it reaches through direct calls. Defined
+// callees contribute their bodies, declared ones their name and any stored
+// summary, and both their annotated roles, so changing a helper in this
+// module or re-summarizing one in another invalidates the verdict.
+static std::string verdictKey(Function &Entry, const ota::AnnotatedRoles &Annotations) {
+    SHA256 Hash;
+    hashString(Hash, OTA_PLUGIN_VERSION);
+    hashString(Hash, LLVM_VERSION_STRING);
+    hashInt(Hash, PolicyVersion);
+    for (const ota::CalleeRoleEntry &Role : ota::CalleeRoleTable) {
+        hashString(Hash, StringRef(Role.Name.data(), Role.Name.size()));
+        hashInt(Hash, Role.Roles);
+    }
+    for (const OrderingRule &Rule : OrderingRules) {
+        hashInt(Hash, Rule.PrerequisiteRole);
+        hashInt(Hash, Rule.GuardedRole);
+        hashString(Hash, Rule.RuleId);
+        hashString(Hash, Rule.Message);
+    }
+    const ota::BannedApiList *Banned = bannedApiList();
+    hashInt(Hash, Banned ? Banned->size() : 0);
+    if (Banned) {
+        for (const std::string &Entry : Banned->entries()) {
+            hashString(Hash, Entry);
+        }
+    }
+
+    SmallPtrSet<Function *, 32> Seen;
+    std::vector<Function *> Reached;
+    std::vector<Function *> Worklist = {&Entry};
+    Seen.insert(&Entry);
+    while (!Worklist.empty()) {
+        Function *F = Worklist.back();
+        Worklist.pop_back();
+        Reached.push_back(F);
+        for (Instruction &I : instructions(*F)) {
+            auto *CB = dyn_cast<CallBase>(&I);
+            Function *Callee = CB ? CB->getCalledFunction() : nullptr;
+            if (Callee && Seen.insert(Callee).second) {
+                Worklist.push_back(Callee);
+            }
+        }
+    }
+
+    // The entry first, then callees by name, so the key does not depend on
+    // the order functions appear in the module.
+    std::sort(Reached.begin() + 1, Reached.end(),
+              [](const Function *A, const Function *B) { return A->getName() < B->getName(); });
+
+    const ota::SummaryDatabase *Database = summaryDatabase();
+    for (Function *F : Reached) {
+        hashInt(Hash, Annotations.rolesOf(*F));
+        if (!F->isDeclaration()) {
+            hashInt(Hash, 'D');
+            ota::hashFunctionStructure(*F, Hash);
+            continue;
+        }
+
+        hashInt(Hash, 'X');
+        hashString(Hash, F->getName());
+        Optional<ota::SummaryDatabase::Entry> Stored;
+        if (Database) {
+            Stored = Database->lookup(F->getName());
+        }
+        hashInt(Hash, Stored.hasValue());
+        if (Stored) {
+            hashInt(Hash, Stored->alwaysRoles());
+            hashInt(Hash, Stored->ifNonZeroRoles());
+            hashInt(Hash, Stored->installPrereqs());
+            hashInt(Hash, Stored->mayInstall());
+            hashInt(Hash, Stored->installsRollbackGuarded());
+            hashInt(Hash, Stored->installArg());
+            hashString(Hash, toStringRef(Stored->alwaysArgRoles()));
+            hashString(Hash, toStringRef(Stored->ifNonZeroArgRoles()));
+        }
+    }
+
+    return toHex(Hash.final(), /*LowerCase=*/true);
+}
+
+// Opened once per module checked, so the hit and miss counts are per module. The slice
+// report needs the analysis itself, so it bypasses the cache.
+static std::unique_ptr<ota::VerdictCache> openVerdictCache() {
+    if (VerdictCacheDir.empty() || ReportSlice) {
+        return nullptr;
+    }
+
+    auto CacheOrErr = ota::VerdictCache::open(VerdictCacheDir);
+    if (!CacheOrErr) {
+        report_fatal_error(Twine("[OTA Security Pass] ") + toString(CacheOrErr.takeError()), false);
+    }
+    return std::move(*CacheOrErr);
+}
+
+static void storeVerdict(ota::VerdictCache &Cache, StringRef Key,
+                         ArrayRef<ota::PolicyViolation> Violations) {
+    if (Error Err = Cache.store(Key, Violations)) {
+        report_fatal_error(Twine("[OTA Security Pass] ") + toString(std::move(Err)), false);
+    }
+}
+
+static void reportVerdictCache(const ota::VerdictCache &Cache) {
+    errs() << "[OTA Security Pass] verdict cache: " << Cache.hits() << " hits, "
+           << Cache.misses() << " misses\n";
+}
+
+static std::vector<Function *> entryPointsOf(Module &M, const ota::AnnotatedRoles &Annotations) {
+    std::vector<Function *> Entries;
+    for (Function &F : M) {
+        // A ThinLTO backend sees other modules' entries as imported
+        // available_externally copies; their own backends check them.
+        if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage() &&
+            ota::isEntryPoint(F, Annotations)) {
+            Entries.push_back(&F);
+        }
+    }
+    return Entries;
+}
+
+// Summaries for checking F alone: only the helpers it reaches are summarized,
+// and only its own call sites indexed, so the cost follows F's call closure
+// rather than the module. Functions refers to Annotations, so this stays put.
+struct AloneSummaries {
+    explicit AloneSummaries(Function &F)
+        : Annotations(parseAnnotations(*F.getParent())),
+          Functions(summarizeModule(*F.getParent(), Annotations, {&F})),
+          Sites(F, classifyCallsIn(F, Functions)) {}
+    AloneSummaries(const AloneSummaries &) = delete;
+    AloneSummaries &operator=(const AloneSummaries &) = delete;
+
+    ota::AnnotatedRoles Annotations;
+    FunctionSummaries Functions;
+    SecurityCallSiteIndex Sites;
+};
+
+static ota::PolicyResult checkAlone(Function &F, DominatorTree &DT, MemorySSA &MSSA,
+                                    AAResults &AA) {
+    AloneSummaries Alone(F);
+    return checkFunction(F, DT, MSSA, AA, Alone.Sites);
+}
+
+static std::string formatViolations(const Function &F, ArrayRef<ota::PolicyViolation> Violations) {
+    std::string Message = "[OTA Security Pass] Security policy violation(s) in " +
+                          F.getName().str() + "():\n";
+    for (const ota::PolicyViolation &V : Violations) {
+        Message += " - " + V.describe() + "\n";
+        if (!V.Witness.empty()) {
+            Message += "   witness: ";
+            for (const ota::WitnessStep &Step : V.Witness) {
+                if (&Step != &V.Witness.front()) {
+                    Message += " -> ";
+                }
+                Message += Step.Block;
+                if (Step.Line != 0) {
+                    Message += " (" + Step.File + ":" + std::to_string(Step.Line) + ")";
+                }
+            }
+            Message += "\n";
+        }
+    }
+    return Message;
+}
+
+static const int PolicyViolationKind = getNextAvailablePluginDiagnosticKind();
+static const int PolicyBudgetKind = getNextAvailablePluginDiagnosticKind();
+
+static std::vector<ota::PolicyViolation> &sarifResults() {
+    static std::vector<ota::PolicyViolation> Results;
+    return Results;
+}
+
+static std::string roleNames(uint32_t Roles) {
+    static const char *const Names[ota::RoleBitCount] = {
+        "install", "verify", "trusted-source", "sensitive-logging",
+        "weak-crypto", "erase-slot", "write-slot", "banned",
+    };
+    std::string Result;
+    for (unsigned Bit = 0; Bit != ota::RoleBitCount; ++Bit) {
+        if (Roles & (1u << Bit)) {
+            Result += Result.empty() ? "" : ",";
+            Result += Names[Bit];
+        }
+    }
+    return Result.empty() ? "none" : Result;
+}
+
+// One remark per check at each guarded call, on the pass's own thread: the
+// context's remark streamer is not thread-safe. A check that holds is an
+// OptimizationRemark, one that fails an OptimizationRemarkMissed, both named
+// by rule ID under the pass name ota-policy.
+static void emitPolicyRemarks(const Function &F, const ota::PolicyResult &Result,
+                              OptimizationRemarkEmitter &ORE) {
+    for (const ota::GuardedSiteStatus &Site : Result.GuardedSites) {
+        StringRef Callee = Site.Call->getCalledFunction()->getName();
+        for (const OrderingRule &Rule : OrderingRules) {
+            if (!(Site.Roles & Rule.GuardedRole)) {
+                continue;
+            }
+            std::string Prerequisite = roleNames(Rule.PrerequisiteRole);
+            if (Site.RolesBefore & Rule.PrerequisiteRole) {
+                ORE.emit([&] {
+                    return OptimizationRemark(DEBUG_TYPE, Rule.RuleId, Site.Call)
+                           << ore::NV("Callee", Callee) << " in " << ore::NV("Entry", F.getName())
+                           << " is preceded by " << ore::NV("Prerequisite", Prerequisite)
+                           << " on all paths";
+                });
+            } else {
+                ORE.emit([&] {
+                    return OptimizationRemarkMissed(DEBUG_TYPE, Rule.RuleId, Site.Call)
+                           << ore::NV("Callee", Callee) << " in " << ore::NV("Entry", F.getName())
+                           << " is not preceded by " << ore::NV("Prerequisite", Prerequisite)
+                           << " on all paths";
+                });
+            }
+        }
+
+        if (!(Site.Roles & ota::RoleInstall)) {
+            continue;
+        }
+        if (Site.RollbackGuarded) {
+            ORE.emit([&] {
+                return OptimizationRemark(DEBUG_TYPE, "ota-rollback-guard", Site.Call)
+                       << ore::NV("Callee", Callee) << " in " << ore::NV("Entry", F.getName())
+                       << " is gated by a rollback guard";
+            });
+        } else {
+            ORE.emit([&] {
+                return OptimizationRemarkMissed(DEBUG_TYPE, "ota-rollback-guard", Site.Call)
+                       << ore::NV("Callee", Callee) << " in " << ore::NV("Entry", F.getName())
+                       << " is not gated by a rollback guard";
+            });
+        }
+    }
+}
+
+// Reports violations as error diagnostics and keeps going, so one run lists
+// every violating function. The context's handler gets each one first, as in
+// LLVMContext::diagnose; when it leaves it unhandled (opt), the default
+// handling would exit on the first error, so the diagnostic is printed the
+// same way here instead and finish() fails the run once all are out.
+class ViolationReporter {
+public:
+    void report(const Function &F, ArrayRef<ota::PolicyViolation> Violations) {
+        if (!SarifPath.empty()) {
+            llvm::append_range(sarifResults(), Violations);
+        }
+
+        ota::PolicyViolationDiagnostic Diag(F, Violations);
+        // The context hands out only a const view of the handler it calls
+        // itself; taking ownership and back would drop its filter setting.
+        auto *Handler = const_cast<DiagnosticHandler *>(F.getContext().getDiagHandlerPtr());
+        if (Handler->handleDiagnostics(Diag)) {
+            return;
+        }
+
+        DiagnosticPrinterRawOStream DP(errs());
+        errs() << LLVMContext::getDiagnosticMessagePrefix(DS_Error) << ": ";
+        Diag.print(DP);
+        errs() << "\n";
+        ++Unhandled;
+    }
+
+    // Overruns are only warnings: the conservative check has already given
+    // the verdict.
+    void reportOverruns(const Function &F, ArrayRef<ota::BudgetOverrun> Overruns) {
+        for (const ota::BudgetOverrun &Overrun : Overruns) {
+            F.getContext().diagnose(ota::PolicyBudgetDiagnostic(F, Overrun));
+        }
+    }
+
+    // Also (re)writes the SARIF log, with everything found so far in this
+    // process, so a batch of modules ends up in one log.
+    void finish() {
+        if (!SarifPath.empty()) {
+            if (Error Err = ota::writeSarifLog(sarifLogPath(), sarifResults())) {
+                report_fatal_error(Twine("[OTA Security Pass] ") + toString(std::move(Err)), false);
+            }
+        }
+
+        if (Unhandled == 0) {
+            return;
+        }
+        unsigned Count = Unhandled;
+        Unhandled = 0;
+        report_fatal_error(Twine("[OTA Security Pass] ") + Twine(Count) +
+                               " function(s) violate the security policy",
+                           false);
+    }
+
+private:
+    unsigned Unhandled = 0;
+};
+
+// Annotations of the module a function pass is running over, parsed on its
+// first function rather than on every one.
+class ModuleAnnotations {
+public:
+    const ota::AnnotatedRoles &get(const Module &M) {
+        if (&M != Parsed) {
+            Annotations = parseAnnotations(M);
+            Parsed = &M;
+        }
+        return Annotations;
+    }
+
+private:
+    const Module *Parsed = nullptr;
+    ota::AnnotatedRoles Annotations;
+};
+
+class TraversalPass : public PassInfoMixin<TraversalPass> {
+public:
+    // Not skipped for optnone functions or by -opt-bisect-limit: a check that
+    // does not run would let the build pass.
+    static bool isRequired() { return true; }
+
+    PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+        const ota::AnnotatedRoles &Annotations = Parsed.get(*F.getParent());
+
+        if (F.isDeclaration() || !ota::isEntryPoint(F, Annotations))
+            return PreservedAnalyses::all();
+
+        // The run fails, if it has to, after the module's last entry point.
+        if (F.getParent() != Counted) {
+            Counted = F.getParent();
+            EntriesLeft = count_if(*Counted, [&](const Function &G) {
+                return !G.isDeclaration() && ota::isEntryPoint(G, Annotations);
+            });
+            Cache = openVerdictCache();
+        }
+
+        // A cached verdict carries no per-check results, so a run that asks
+        // for remarks analyzes the function anyway.
+        bool Remarks = OptimizationRemarkEmitter::allowExtraAnalysis(F, DEBUG_TYPE);
+        std::string Key;
+        Optional<std::vector<ota::PolicyViolation>> Cached;
+        if (Cache) {
+            Key = verdictKey(F, Annotations);
+            if (!Remarks) {
+                Cached = Cache->lookup(Key);
+            }
+        }
+
+        std::vector<ota::PolicyViolation> Violations;
+        if (Cached) {
+            Violations = std::move(*Cached);
+        } else {
+            const ota::PolicyResult &Result = FAM.getResult<ota::OTAPolicyAnalysis>(F);
+            if (Remarks) {
+                emitPolicyRemarks(F, Result, FAM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+            }
+            Reporter.reportOverruns(F, Result.Overruns);
+            Violations = Result.Violations;
+            // A conservative verdict is not kept: it depends on the budgets.
+            if (Cache && Result.Overruns.empty()) {
+                storeVerdict(*Cache, Key, Violations);
+            }
+        }
+
+        if (!Violations.empty()) {
+            Reporter.report(F, Violations);
+        }
+        if (--EntriesLeft == 0) {
+            if (Cache) {
+                reportVerdictCache(*Cache);
+                Cache.reset();
+            }
+            writeTimingLog();
+            Reporter.finish();
+        }
+
+        return PreservedAnalyses::all();
+    }
+
+private:
+    ModuleAnnotations Parsed;
+    ViolationReporter Reporter;
+    const Module *Counted = nullptr;
+    unsigned EntriesLeft = 0;
+    std::unique_ptr<ota::VerdictCache> Cache;
+};
+
+// Checks every entry point of a module in one run. The checks run through
+// OTAModulePolicyAnalysis, which fans them out over a thread pool; results are
+// merged back in module order so the report does not depend on scheduling.
+class TraversalModulePass : public PassInfoMixin<TraversalModulePass> {
+public:
+    static bool isRequired() { return true; }
+
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
+        FunctionAnalysisManager &FAM =
+            MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+        ota::AnnotatedRoles Annotations = parseAnnotations(M);
+        std::vector<Function *> Entries = entryPointsOf(M, Annotations);
+        if (Entries.empty()) {
+            // Nothing to check still leaves logs behind for -ota-sarif and
+            // -ota-timing-json.
+            writeTimingLog();
+            ViolationReporter().finish();
+            return PreservedAnalyses::all();
+        }
 
-                if (isInList(Name,
-                             {"MD5", "MD5_Init", "MD5_Update", "MD5_Final", "SHA1", "SHA1_Init", "SHA1_Update", "SHA1_Final", "rand", "srand"})) {
-                    Violations.push_back("Weak crypto or weak entropy API inside updateFirmware(): " +
-                                         Name.str() + " at " + instructionSite(CI));
+        ViolationReporter Reporter;
+
+        // Cached verdicts are looked up first; only the misses are analyzed.
+        // A run that asks for remarks needs every per-check result and
+        // analyzes them all.
+        std::unique_ptr<ota::VerdictCache> Cache = openVerdictCache();
+        bool Remarks = OptimizationRemarkEmitter::allowExtraAnalysis(M.getContext(), DEBUG_TYPE);
+        std::vector<std::vector<ota::PolicyViolation>> Results(Entries.size());
+        std::vector<std::string> Keys(Entries.size());
+        std::vector<size_t> Misses;
+        for (size_t Idx = 0, E = Entries.size(); Idx != E; ++Idx) {
+            if (Cache) {
+                Keys[Idx] = verdictKey(*Entries[Idx], Annotations);
+                Optional<std::vector<ota::PolicyViolation>> Cached;
+                if (!Remarks) {
+                    Cached = Cache->lookup(Keys[Idx]);
+                }
+                if (Cached) {
+                    Results[Idx] = std::move(*Cached);
+                    continue;
                 }
             }
+            Misses.push_back(Idx);
         }
 
-        for (CallInst *InstallCI : InstallCalls) {
-            bool VerifyDominates = false;
-            for (CallInst *VerifyCI : VerifyCalls) {
-                if (DT.dominates(VerifyCI, InstallCI)) {
-                    VerifyDominates = true;
-                    break;
+        if (!Misses.empty()) {
+            // A result an earlier pass computed through the analysis manager
+            // is reused; the rest share one module-wide set of summaries.
+            std::vector<const ota::PolicyResult *> Checked(Entries.size());
+            std::vector<Function *> Unchecked;
+            for (size_t Idx : Misses) {
+                Checked[Idx] = FAM.getCachedResult<ota::OTAPolicyAnalysis>(*Entries[Idx]);
+                if (!Checked[Idx]) {
+                    Unchecked.push_back(Entries[Idx]);
                 }
             }
-            if (!VerifyDominates) {
-                Violations.push_back("Install call is not dominated by signature verification on all paths at " +
-                                     instructionSite(InstallCI));
+
+            if (!Unchecked.empty()) {
+                ota::ModulePolicy &Policy = MAM.getResult<ota::OTAModulePolicyAnalysis>(M);
+                Policy.computeAll(Unchecked, FAM);
+                for (size_t Idx : Misses) {
+                    if (!Checked[Idx]) {
+                        Checked[Idx] = Policy.lookup(*Entries[Idx]);
+                    }
+                }
             }
 
-            bool SourceDominates = false;
-            for (CallInst *TrustedCI : TrustedSourceCalls) {
-                if (DT.dominates(TrustedCI, InstallCI)) {
-                    SourceDominates = true;
-                    break;
+            for (size_t Idx : Misses) {
+                if (!Checked[Idx]) {
+                    continue;
                 }
+                Function &F = *Entries[Idx];
+                Results[Idx] = Checked[Idx]->Violations;
+                if (Remarks) {
+                    emitPolicyRemarks(F, *Checked[Idx],
+                                      FAM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+                }
+                Reporter.reportOverruns(F, Checked[Idx]->Overruns);
             }
-            if (!SourceDominates) {
-                Violations.push_back("Install call is not dominated by trusted source validation on all paths at " +
-                                     instructionSite(InstallCI));
+
+            // A conservative verdict is not kept: it depends on the budgets.
+            if (Cache) {
+                for (size_t Idx : Misses) {
+                    if (!Checked[Idx] || !Checked[Idx]->Overruns.empty()) {
+                        continue;
+                    }
+                    storeVerdict(*Cache, Keys[Idx], Results[Idx]);
+                }
             }
+        }
+
+        if (Cache) {
+            reportVerdictCache(*Cache);
+        }
 
-            if (!hasRollbackGuardBeforeInstall(F, DT, InstallCI)) {
-                Violations.push_back("Rollback guard '(new_version > current_version)' does not gate install path at " +
-                                     instructionSite(InstallCI));
+        for (size_t Idx = 0, E = Entries.size(); Idx != E; ++Idx) {
+            if (!Results[Idx].empty()) {
+                Reporter.report(*Entries[Idx], Results[Idx]);
             }
         }
+        writeTimingLog();
+        Reporter.finish();
 
-        if (!Violations.empty()) {
-            std::string Message =
-                "[OTA Security Pass] Security policy violation(s) in updateFirmware():\n";
-            for (const std::string &V : Violations) {
-                Message += " - " + V + "\n";
+        return PreservedAnalyses::all();
+    }
+};
+
+// Writes the summaries of this module's externally visible functions to the
+// summary database, so checks of other translation units can see through
+// calls into them.
+class SummarizePass : public PassInfoMixin<SummarizePass> {
+public:
+    static bool isRequired() { return true; }
+
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+        if (SummaryDatabasePath.empty()) {
+            report_fatal_error("[OTA Security Pass] ota-summarize needs -ota-summary-db=PATH", false);
+        }
+
+        std::vector<Function *> Defined;
+        for (Function &F : M) {
+            if (!F.isDeclaration()) {
+                Defined.push_back(&F);
+            }
+        }
+
+        ota::AnnotatedRoles Annotations = parseAnnotations(M);
+        FunctionSummaries Summaries = summarizeModule(M, Annotations, Defined, /*SummarizeRoots=*/true);
+        std::vector<ota::SymbolSummary> Exported;
+        for (Function *F : Defined) {
+            if (F->hasLocalLinkage()) {
+                continue;
+            }
+            // An annotated function is not summarized here, but callers in
+            // other translation units only see its declaration.
+            if (uint32_t Roles = Annotations.rolesOf(*F)) {
+                Exported.push_back(summaryForDatabase(*F, summaryOfRoles(*F, Roles)));
+            } else if (const FunctionSummary *Summary = Summaries.lookup(*F)) {
+                for (const ota::BudgetOverrun &Overrun : Summary->Overruns) {
+                    if (Overrun.Function == F->getName()) {
+                        F->getContext().diagnose(ota::PolicyBudgetDiagnostic(*F, Overrun));
+                    }
+                }
+                Exported.push_back(summaryForDatabase(*F, *Summary));
             }
-            report_fatal_error(StringRef(Message), false);
         }
 
+        if (Error Err = ota::SummaryDatabase::update(SummaryDatabasePath, std::move(Exported))) {
+            report_fatal_error(Twine("[OTA Security Pass] ") + toString(std::move(Err)), false);
+        }
+        return PreservedAnalyses::all();
+    }
+};
+
+// print<ota-policy>: dumps the analysis result of each entry point, for
+// reporting tools and for checking what the engine concluded.
+class OTAPolicyPrinterPass : public PassInfoMixin<OTAPolicyPrinterPass> {
+public:
+    explicit OTAPolicyPrinterPass(raw_ostream &OS) : OS(OS) {}
+
+    PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
+        if (F.isDeclaration() || !ota::isEntryPoint(F, Parsed.get(*F.getParent()))) {
+            return PreservedAnalyses::all();
+        }
+
+        const ota::PolicyResult &Result = FAM.getResult<ota::OTAPolicyAnalysis>(F);
+        OS << "OTA policy for " << F.getName() << "():\n";
+        for (const ota::PolicyCallSite &Site : Result.CallSites) {
+            OS << "  call " << Site.Call->getCalledFunction()->getName() << " ["
+               << roleNames(Site.Roles) << (Site.Summarized ? ", summarized" : "") << "] at "
+               << instructionSite(Site.Call) << "\n";
+        }
+        for (const ota::GuardedSiteStatus &Site : Result.GuardedSites) {
+            OS << "  guarded " << Site.Call->getCalledFunction()->getName() << " ["
+               << roleNames(Site.Roles) << "] preceded by [" << roleNames(Site.RolesBefore) << "]";
+            if (Site.SubjectArgument >= 0) {
+                OS << ", subject arg " << Site.SubjectArgument;
+            }
+            if (Site.Roles & ota::RoleInstall) {
+                OS << (Site.RollbackGuarded ? ", rollback-guarded" : ", not rollback-guarded");
+            }
+            OS << "\n";
+        }
+        for (const ota::BudgetOverrun &Overrun : Result.Overruns) {
+            OS << "  budget exceeded in " << Overrun.Function << "(): " << Overrun.Budget << " "
+               << Overrun.Used << " > " << Overrun.Limit << "\n";
+        }
+        OS << "  " << Result.Violations.size() << " violation(s)\n";
         return PreservedAnalyses::all();
     }
+
+private:
+    raw_ostream &OS;
+    ModuleAnnotations Parsed;
 };
 
 } 
 
+struct ota::ModulePolicy::SharedSummaries {
+    explicit SharedSummaries(Module &M)
+        : Annotations(parseAnnotations(M)), EntryList(entryPointsOf(M, Annotations)),
+          Functions(summarizeModule(M, Annotations, EntryList)), Sites(M, Functions),
+          Entries(EntryList.begin(), EntryList.end()) {}
+
+    AnnotatedRoles Annotations;
+    std::vector<Function *> EntryList;
+    FunctionSummaries Functions;
+    SecurityCallSiteIndex Sites;
+    SmallPtrSet<const Function *, 8> Entries;
+};
+
+ota::ModulePolicy::ModulePolicy(Module &M) : Shared(std::make_unique<SharedSummaries>(M)) {}
+
+ota::ModulePolicy::ModulePolicy(ModulePolicy &&) = default;
+ota::ModulePolicy::~ModulePolicy() = default;
+
+const ota::PolicyResult *ota::ModulePolicy::lookup(const Function &F) const {
+    auto It = Results.find(&F);
+    return It == Results.end() ? nullptr : It->second.get();
+}
+
+void ota::ModulePolicy::computeAll(ArrayRef<Function *> Functions, FunctionAnalysisManager &FAM) {
+    // Everything that touches the analysis manager or the LLVMContext is built
+    // on this thread: function analyses, the summaries of functions other than
+    // the entry points, and each function's assumption cache, which otherwise
+    // scans lazily and registers value handles from whichever task queries it
+    // first. The checks then fan out, each task owning its scratch state.
+    std::vector<Function *> Pending;
+    std::vector<DominatorTree *> Trees;
+    std::vector<MemorySSA *> MemorySSAs;
+    std::vector<AAResults *> AliasResults;
+    std::vector<std::unique_ptr<AloneSummaries>> Alone;
+    for (Function *F : Functions) {
+        if (!Results.count(F) && !llvm::is_contained(Pending, F)) {
+            Pending.push_back(F);
+            Trees.push_back(&FAM.getResult<DominatorTreeAnalysis>(*F));
+            MemorySSAs.push_back(&FAM.getResult<MemorySSAAnalysis>(*F).getMSSA());
+            AliasResults.push_back(&FAM.getResult<AAManager>(*F));
+            (void)FAM.getResult<AssumptionAnalysis>(*F).assumptions();
+            Alone.push_back(Shared->Entries.count(F) ? nullptr
+                                                     : std::make_unique<AloneSummaries>(*F));
+        }
+    }
+
+    auto Compute = [&](size_t Idx) {
+        const SecurityCallSiteIndex &Sites = Alone[Idx] ? Alone[Idx]->Sites : Shared->Sites;
+        return checkFunction(*Pending[Idx], *Trees[Idx], *MemorySSAs[Idx], *AliasResults[Idx], Sites);
+    };
+
+    std::vector<PolicyResult> Computed(Pending.size());
+    if (Pending.size() == 1) {
+        Computed[0] = Compute(0);
+    } else if (!Pending.empty()) {
+        ThreadPool Pool(hardware_concurrency(CheckThreads));
+        for (size_t Idx = 0, E = Pending.size(); Idx != E; ++Idx) {
+            Pool.async([&, Idx] { Computed[Idx] = Compute(Idx); });
+        }
+        Pool.wait();
+    }
+
+    for (size_t Idx = 0, E = Pending.size(); Idx != E; ++Idx) {
+        Results[Pending[Idx]] = std::make_unique<PolicyResult>(std::move(Computed[Idx]));
+    }
+}
+
+AnalysisKey ota::OTAModulePolicyAnalysis::Key;
+
+ota::ModulePolicy ota::OTAModulePolicyAnalysis::run(Module &M, ModuleAnalysisManager &) {
+    return ModulePolicy(M);
+}
+
+AnalysisKey ota::OTAPolicyAnalysis::Key;
+
+ota::PolicyResult ota::OTAPolicyAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
+    return checkAlone(F, FAM.getResult<DominatorTreeAnalysis>(F),
+                      FAM.getResult<MemorySSAAnalysis>(F).getMSSA(), FAM.getResult<AAManager>(F));
+}
+
+ota::PolicyViolationDiagnostic::PolicyViolationDiagnostic(const Function &F,
+                                                          ArrayRef<ota::PolicyViolation> Violations)
+    : DiagnosticInfoWithLocationBase(static_cast<DiagnosticKind>(PolicyViolationKind), DS_Error, F,
+                                     DiagnosticLocation(F.getSubprogram())),
+      Violations(Violations) {}
+
+void ota::PolicyViolationDiagnostic::print(DiagnosticPrinter &DP) const {
+    if (isLocationAvailable()) {
+        DP << getLocationStr() << ": ";
+    }
+    std::string Message = formatViolations(getFunction(), Violations);
+    DP << StringRef(Message).rtrim('\n');
+}
+
+bool ota::PolicyViolationDiagnostic::classof(const DiagnosticInfo *DI) {
+    return DI->getKind() == PolicyViolationKind;
+}
+
+ota::PolicyBudgetDiagnostic::PolicyBudgetDiagnostic(const Function &F,
+                                                    const ota::BudgetOverrun &Overrun)
+    : DiagnosticInfoWithLocationBase(static_cast<DiagnosticKind>(PolicyBudgetKind), DS_Warning, F,
+                                     DiagnosticLocation(F.getSubprogram())),
+      Overrun(Overrun) {}
+
+void ota::PolicyBudgetDiagnostic::print(DiagnosticPrinter &DP) const {
+    if (isLocationAvailable()) {
+        DP << getLocationStr() << ": ";
+    }
+    DP << "[OTA Security Pass] " << Overrun.Function << "() exceeded its " << Overrun.Budget
+       << " budget (" << Overrun.Used << " > " << Overrun.Limit << ")";
+    if (Overrun.Function == getFunction().getName()) {
+        DP << " and was checked conservatively";
+    } else {
+        DP << " and was summarized conservatively for " << getFunction().getName() << "()";
+    }
+}
+
+bool ota::PolicyBudgetDiagnostic::classof(const DiagnosticInfo *DI) {
+    return DI->getKind() == PolicyBudgetKind;
+}
+
+ArrayRef<ota::PolicyRule> ota::policyRules() {
+    return PolicyRules;
+}
+
+std::string ota::PolicyViolation::describe() const {
+    if (File.empty()) {
+        return Message + " at " + Site;
+    }
+    return Message + " at " + File + ":" + std::to_string(Line) + ":" + std::to_string(Column);
+}
+
+bool ota::isEntryPoint(const Function &F, const AnnotatedRoles &Annotations) {
+    if (Annotations.isEntry(F)) {
+        return true;
+    }
+    if (EntryPoints.empty()) {
+        return F.getName() == "updateFirmware";
+    }
+    return llvm::is_contained(EntryPoints, F.getName());
+}
+
+bool ota::isPolicyRelevant(const Module &M) {
+    AnnotatedRoles Annotations = parseAnnotations(M);
+    const SummaryDatabase *Database = summaryDatabase();
+    for (const Function &F : M) {
+        if (!F.isDeclaration() && isEntryPoint(F, Annotations)) {
+            return true;
+        }
+        if (calleeRoles(F, Annotations) & RoleInstall) {
+            return true;
+        }
+        if (Database && F.isDeclaration()) {
+            Optional<SummaryDatabase::Entry> Stored = Database->lookup(F.getName());
+            if (Stored && Stored->mayInstall()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
 llvmGetPassPluginInfo() {
     return {
         LLVM_PLUGIN_API_VERSION, "TraversalPass", LLVM_VERSION_STRING,
         [](PassBuilder &PB) {
+            PB.registerAnalysisRegistrationCallback([](FunctionAnalysisManager &FAM) {
+                FAM.registerPass([] { return ota::OTAPolicyAnalysis(); });
+            });
+            PB.registerAnalysisRegistrationCallback([](ModuleAnalysisManager &MAM) {
+                MAM.registerPass([] { return ota::OTAModulePolicyAnalysis(); });
+            });
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -429,8 +3120,67 @@ llvmGetPassPluginInfo() {
                         FPM.addPass(TraversalPass());
                         return true;
                     }
+                    if (Name == "print<ota-policy>") {
+                        FPM.addPass(OTAPolicyPrinterPass(outs()));
+                        return true;
+                    }
+                    return false;
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                    if (Name == "traversal-module-pass") {
+                        MPM.addPass(TraversalModulePass());
+                        return true;
+                    }
+                    if (Name == "ota-summarize") {
+                        MPM.addPass(SummarizePass());
+                        return true;
+                    }
                     return false;
                 });
+
+            // Link-time checking. Full LTO checks the merged image once, before
+            // it is optimized. ThinLTO backends each check their own module, in
+            // parallel, and see other modules' helpers through the summary
+            // database the pre-link compiles wrote. Compiles run the
+            // pipeline-start callbacks and ThinLTO backends do not, which is
+            // how -ota-lto-check tells them apart.
+            auto InCompile = std::make_shared<bool>(false);
+#if LLVM_VERSION_MAJOR >= 15
+            PB.registerFullLinkTimeOptimizationEarlyEPCallback(
+                [](ModulePassManager &MPM, OptimizationLevel) {
+                    MPM.addPass(TraversalModulePass());
+                });
+#endif
+            PB.registerPipelineStartEPCallback(
+                [InCompile](ModulePassManager &MPM, OptimizationLevel) {
+                    *InCompile = true;
+                    if (LTOSummarize) {
+                        MPM.addPass(SummarizePass());
+                    }
+                });
+            PB.registerPipelineEarlySimplificationEPCallback(
+                [InCompile](ModulePassManager &MPM, OptimizationLevel) {
+                    bool ThinLTOBackend = !*InCompile;
+                    *InCompile = false;
+                    if (PipelineCheck || (LTOCheck && ThinLTOBackend)) {
+                        MPM.addPass(TraversalModulePass());
+                        return;
+                    }
+#if LLVM_VERSION_MAJOR < 15
+                    // Full LTO cannot be hooked here, and checking this compile
+                    // alone is not what was asked for.
+                    if (LTOCheck) {
+                        report_fatal_error("[OTA Security Pass] -ota-lto-check only checks ThinLTO "
+                                           "backends on LLVM 14, which has no full-LTO extension "
+                                           "point; check full LTO links with "
+                                           "--lto-newpm-passes='traversal-module-pass,lto<O2>', "
+                                           "or compiles with -ota-pipeline-check",
+                                           false);
+                    }
+#endif
+                });
         }};
 }
 
@@ -0,0 +1,343 @@
+#include "VerdictCache.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace ota {
+
+namespace {
+
+// Followed by one JSON object per violation, one per line.
+constexpr StringRef VerdictHeader = "OTA-VERDICT 3";
+
+class StructureHasher {
+public:
+    explicit StructureHasher(SHA256 &Hash) : Hash(Hash) {}
+
+    void function(const Function &F) {
+        str(F.getName());
+        type(F.getFunctionType());
+
+        // Number every local first; PHIs may refer to values defined later.
+        for (const Argument &A : F.args()) {
+            Local.try_emplace(&A, Local.size());
+        }
+        for (const BasicBlock &BB : F) {
+            Local.try_emplace(&BB, Local.size());
+            for (const Instruction &I : BB) {
+                Local.try_emplace(&I, Local.size());
+            }
+        }
+
+        for (const Argument &A : F.args()) {
+            str(A.getName());
+        }
+        for (const BasicBlock &BB : F) {
+            str(BB.getName());
+            u64(BB.size());
+            for (const Instruction &I : BB) {
+                instruction(I);
+            }
+        }
+    }
+
+private:
+    enum OperandTag : uint64_t {
+        TagLocal = 1,
+        TagInt,
+        TagFloat,
+        TagGlobal,
+        TagExpr,
+        TagData,
+        TagAggregate,
+        TagAsm,
+        TagMetadata,
+        TagOtherConstant,
+    };
+
+    void u64(uint64_t V) {
+        uint8_t Bytes[8];
+        support::endian::write64le(Bytes, V);
+        Hash.update(Bytes);
+    }
+
+    void str(StringRef S) {
+        u64(S.size());
+        Hash.update(S);
+    }
+
+    void apInt(const APInt &V) {
+        u64(V.getBitWidth());
+        for (unsigned Word = 0, E = V.getNumWords(); Word != E; ++Word) {
+            u64(V.getRawData()[Word]);
+        }
+    }
+
+    void type(Type *T) {
+        u64(T->getTypeID());
+        if (auto *IT = dyn_cast<IntegerType>(T)) {
+            u64(IT->getBitWidth());
+        } else if (auto *AT = dyn_cast<ArrayType>(T)) {
+            u64(AT->getNumElements());
+            type(AT->getElementType());
+        } else if (auto *VT = dyn_cast<VectorType>(T)) {
+            u64(VT->getElementCount().getKnownMinValue());
+            type(VT->getElementType());
+        } else if (auto *ST = dyn_cast<StructType>(T)) {
+            if (ST->hasName()) {
+                str(ST->getName());
+            } else {
+                u64(ST->getNumElements());
+                for (Type *Elt : ST->elements()) {
+                    type(Elt);
+                }
+            }
+        } else if (auto *FT = dyn_cast<FunctionType>(T)) {
+            type(FT->getReturnType());
+            u64(FT->getNumParams());
+            for (Type *Param : FT->params()) {
+                type(Param);
+            }
+            u64(FT->isVarArg());
+        } else if (auto *PT = dyn_cast<PointerType>(T)) {
+            u64(PT->getAddressSpace());
+        }
+    }
+
+    void operand(const Value *V) {
+        auto It = Local.find(V);
+        if (It != Local.end()) {
+            u64(TagLocal);
+            u64(It->second);
+            return;
+        }
+
+        if (auto *CI = dyn_cast<ConstantInt>(V)) {
+            u64(TagInt);
+            apInt(CI->getValue());
+        } else if (auto *CF = dyn_cast<ConstantFP>(V)) {
+            u64(TagFloat);
+            type(CF->getType());
+            apInt(CF->getValueAPF().bitcastToAPInt());
+        } else if (auto *GV = dyn_cast<GlobalValue>(V)) {
+            u64(TagGlobal);
+            str(GV->getName());
+        } else if (auto *CE = dyn_cast<ConstantExpr>(V)) {
+            u64(TagExpr);
+            u64(CE->getOpcode());
+            type(CE->getType());
+            u64(CE->isCompare() ? CE->getPredicate() : 0);
+            if (auto *GEP = dyn_cast<GEPOperator>(CE)) {
+                type(GEP->getSourceElementType());
+            }
+            operands(*CE);
+        } else if (auto *CDS = dyn_cast<ConstantDataSequential>(V)) {
+            u64(TagData);
+            type(CDS->getType());
+            str(CDS->getRawDataValues());
+        } else if (auto *CA = dyn_cast<ConstantAggregate>(V)) {
+            u64(TagAggregate);
+            type(CA->getType());
+            operands(*CA);
+        } else if (auto *Asm = dyn_cast<InlineAsm>(V)) {
+            u64(TagAsm);
+            str(Asm->getAsmString());
+            str(Asm->getConstraintString());
+        } else if (isa<MetadataAsValue>(V)) {
+            u64(TagMetadata);
+        } else {
+            u64(TagOtherConstant);
+            u64(V->getValueID());
+            type(V->getType());
+        }
+    }
+
+    void operands(const User &U) {
+        u64(U.getNumOperands());
+        for (const Use &Op : U.operands()) {
+            operand(Op.get());
+        }
+    }
+
+    void instruction(const Instruction &I) {
+        u64(I.getOpcode());
+        str(I.getName());
+        type(I.getType());
+        operands(I);
+
+        if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+            u64(Cmp->getPredicate());
+        } else if (auto *AI = dyn_cast<AllocaInst>(&I)) {
+            type(AI->getAllocatedType());
+        } else if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+            type(GEP->getSourceElementType());
+        } else if (auto *CB = dyn_cast<CallBase>(&I)) {
+            type(CB->getFunctionType());
+        } else if (auto *PHI = dyn_cast<PHINode>(&I)) {
+            for (const BasicBlock *Incoming : PHI->blocks()) {
+                operand(Incoming);
+            }
+        } else if (auto *Shuffle = dyn_cast<ShuffleVectorInst>(&I)) {
+            SmallVector<int, 16> Mask;
+            Shuffle->getShuffleMask(Mask);
+            for (int Elt : Mask) {
+                u64(static_cast<uint64_t>(Elt));
+            }
+        } else if (auto *EV = dyn_cast<ExtractValueInst>(&I)) {
+            for (unsigned Idx : EV->indices()) {
+                u64(Idx);
+            }
+        } else if (auto *IV = dyn_cast<InsertValueInst>(&I)) {
+            for (unsigned Idx : IV->indices()) {
+                u64(Idx);
+            }
+        }
+
+        // Diagnostics quote source positions, so they are part of the verdict.
+        if (const DILocation *Loc = I.getDebugLoc().get()) {
+            u64(Loc->getLine());
+            u64(Loc->getColumn());
+            str(Loc->getFilename());
+        } else {
+            u64(0);
+        }
+    }
+
+    SHA256 &Hash;
+    DenseMap<const Value *, unsigned> Local;
+};
+
+} // namespace
+
+// Found by argument-dependent lookup from json::parse, so they live in ota.
+static json::Value toJSON(const WitnessStep &Step) {
+    return json::Object{{"block", Step.Block}, {"file", Step.File}, {"line", Step.Line}};
+}
+
+static bool fromJSON(const json::Value &Value, WitnessStep &Step, json::Path P) {
+    json::ObjectMapper O(Value, P);
+    int64_t Line;
+    if (!O || !O.map("block", Step.Block) || !O.map("file", Step.File) || !O.map("line", Line)) {
+        return false;
+    }
+    Step.Line = Line;
+    return true;
+}
+
+static json::Value toJSON(const PolicyViolation &V) {
+    return json::Object{
+        {"rule", V.Rule}, {"function", V.Function}, {"message", V.Message}, {"file", V.File},
+        {"line", V.Line}, {"column", V.Column},     {"site", V.Site},       {"witness", V.Witness},
+    };
+}
+
+static bool fromJSON(const json::Value &Value, PolicyViolation &V, json::Path P) {
+    json::ObjectMapper O(Value, P);
+    int64_t Line, Column;
+    if (!O || !O.map("rule", V.Rule) || !O.map("function", V.Function) ||
+        !O.map("message", V.Message) || !O.map("file", V.File) || !O.map("line", Line) ||
+        !O.map("column", Column) || !O.map("site", V.Site) || !O.map("witness", V.Witness)) {
+        return false;
+    }
+    V.Line = Line;
+    V.Column = Column;
+    return true;
+}
+
+void hashFunctionStructure(const Function &F, SHA256 &Hash) {
+    StructureHasher(Hash).function(F);
+}
+
+Expected<std::unique_ptr<VerdictCache>> VerdictCache::open(StringRef Dir) {
+    if (std::error_code EC = sys::fs::create_directories(Dir)) {
+        return createStringError(EC, "cannot create verdict cache directory '%s': %s",
+                                 Dir.str().c_str(), EC.message().c_str());
+    }
+    return std::unique_ptr<VerdictCache>(new VerdictCache(Dir));
+}
+
+std::string VerdictCache::pathFor(StringRef Key) const {
+    SmallString<128> Path(Dir);
+    sys::path::append(Path, Key + ".verdict");
+    return std::string(Path);
+}
+
+Optional<std::vector<PolicyViolation>> VerdictCache::lookup(StringRef Key) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer = MemoryBuffer::getFile(pathFor(Key));
+    if (!Buffer) {
+        ++Misses;
+        return None;
+    }
+
+    SmallVector<StringRef, 8> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+    if (Lines.empty() || Lines.front() != VerdictHeader) {
+        ++Misses;
+        return None;
+    }
+
+    // An entry that does not parse is treated like a missing one and is
+    // overwritten by the fresh verdict.
+    std::vector<PolicyViolation> Violations;
+    for (StringRef Line : makeArrayRef(Lines).drop_front()) {
+        Expected<PolicyViolation> V = json::parse<PolicyViolation>(Line);
+        if (!V) {
+            consumeError(V.takeError());
+            ++Misses;
+            return None;
+        }
+        Violations.push_back(std::move(*V));
+    }
+    ++Hits;
+    return Violations;
+}
+
+Error VerdictCache::store(StringRef Key, ArrayRef<PolicyViolation> Violations) {
+    std::string Path = pathFor(Key);
+    SmallString<128> TempPath;
+    int FD;
+    if (std::error_code EC = sys::fs::createUniqueFile(Path + ".tmp-%%%%%%", FD, TempPath)) {
+        return createStringError(EC, "cannot write verdict cache entry '%s': %s", Path.c_str(),
+                                 EC.message().c_str());
+    }
+
+    {
+        raw_fd_ostream OS(FD, /*shouldClose=*/true);
+        OS << VerdictHeader << "\n";
+        for (const PolicyViolation &V : Violations) {
+            OS << toJSON(V) << "\n";
+        }
+        OS.close();
+        if (OS.has_error()) {
+            std::error_code EC = OS.error();
+            OS.clear_error();
+            sys::fs::remove(TempPath);
+            return createStringError(EC, "cannot write verdict cache entry '%s': %s",
+                                     TempPath.c_str(), EC.message().c_str());
+        }
+    }
+
+    if (std::error_code EC = sys::fs::rename(TempPath, Path)) {
+        sys::fs::remove(TempPath);
+        return createStringError(EC, "cannot write verdict cache entry '%s': %s", Path.c_str(),
+                                 EC.message().c_str());
+    }
+    return Error::success();
+}
+
+} // namespace ota
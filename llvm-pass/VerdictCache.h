@@ -0,0 +1,56 @@
+#ifndef OTA_VERDICT_CACHE_H
+#define OTA_VERDICT_CACHE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include "OTAPolicy.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Function;
+class SHA256;
+} // namespace llvm
+
+namespace ota {
+
+// Feeds a digest of F's body into Hash: names, types, opcodes, operands,
+// control flow and debug locations, with local values numbered by position.
+// Two functions hash alike exactly when the checks would see them alike, and
+// the digest does not depend on the process or on the rest of the module.
+void hashFunctionStructure(const llvm::Function &F, llvm::SHA256 &Hash);
+
+// Verdicts of earlier runs, one file per key in a directory. A key is a hex
+// digest of everything a verdict depends on; the stored verdict is the list
+// of violations, empty when the function passed.
+class VerdictCache {
+public:
+    static llvm::Expected<std::unique_ptr<VerdictCache>> open(llvm::StringRef Dir);
+
+    llvm::Optional<std::vector<PolicyViolation>> lookup(llvm::StringRef Key);
+
+    // Written to a temporary file and renamed into place, so concurrent
+    // builds sharing the directory never read a partial verdict.
+    llvm::Error store(llvm::StringRef Key, llvm::ArrayRef<PolicyViolation> Violations);
+
+    unsigned hits() const { return Hits; }
+    unsigned misses() const { return Misses; }
+
+private:
+    explicit VerdictCache(llvm::StringRef Dir) : Dir(Dir.str()) {}
+
+    std::string pathFor(llvm::StringRef Key) const;
+
+    std::string Dir;
+    unsigned Hits = 0;
+    unsigned Misses = 0;
+};
+
+} // namespace ota
+
+#endif
@@ -0,0 +1,106 @@
+// Microbenchmark for callee role classification: the perfect-hash table in
+// CalleeRoles.h against the linear name-list scans it replaced.
+//
+//   cmake -S llvm-pass -B llvm-pass/build -DOTA_BUILD_BENCHMARKS=ON
+//   cmake --build llvm-pass/build --target CalleeRoleBench
+//   ./llvm-pass/build/CalleeRoleBench [iterations]
+
+#include "CalleeRoles.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+bool isInList(std::string_view Name, std::initializer_list<std::string_view> Names) {
+    for (std::string_view N : Names) {
+        if (Name == N) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t linearRoles(std::string_view Name) {
+    if (isInList(Name, {"install", "installFirmware", "applyUpdate"})) {
+        return ota::RoleInstall;
+    }
+    if (isInList(Name, {"verifySignature", "verify_signature", "checkSignature"})) {
+        return ota::RoleVerify;
+    }
+    if (isInList(Name, {"sourceTrusted", "isSourceTrusted", "validateSource"})) {
+        return ota::RoleTrustedSource;
+    }
+    if (isInList(Name, {"eraseSlot"})) {
+        return ota::RoleEraseSlot;
+    }
+    if (isInList(Name, {"writeSlot"})) {
+        return ota::RoleWriteSlot;
+    }
+    if (isInList(Name, {"printf", "puts", "fprintf", "perror", "syslog", "vsyslog", "snprintf"})) {
+        return ota::RoleSensitiveLogging;
+    }
+    if (isInList(Name, {"MD5", "MD5_Init", "MD5_Update", "MD5_Final", "SHA1", "SHA1_Init",
+                        "SHA1_Update", "SHA1_Final", "rand", "srand"})) {
+        return ota::RoleWeakCrypto;
+    }
+    return ota::RoleNone;
+}
+
+// Call sites in real update functions are mostly calls to unrelated helpers,
+// so the mix is weighted towards misses.
+std::vector<std::string> callSiteMix() {
+    std::vector<std::string> Names = {
+        "memcpy", "memset", "strncmp", "strlen", "flash_write", "flash_erase",
+        "crc32", "startsWith", "verifyImageHash", "llvm.memcpy.p0.p0.i64",
+        "hal_gpio_set", "ota_state_next", "mbedtls_sha256", "usleep",
+    };
+    for (const ota::CalleeRoleEntry &E : ota::CalleeRoleTable) {
+        Names.emplace_back(E.Name);
+    }
+    return Names;
+}
+
+template <typename ClassifierT>
+double nsPerCallSite(const std::vector<std::string> &Names, unsigned Iterations,
+                     ClassifierT Classify, uint32_t &Sink) {
+    auto Start = std::chrono::steady_clock::now();
+    for (unsigned It = 0; It < Iterations; ++It) {
+        for (const std::string &Name : Names) {
+            Sink += Classify(std::string_view(Name));
+        }
+    }
+    auto Stop = std::chrono::steady_clock::now();
+    double Ns = std::chrono::duration<double, std::nano>(Stop - Start).count();
+    return Ns / (static_cast<double>(Iterations) * Names.size());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    unsigned Iterations = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 200000;
+    std::vector<std::string> Names = callSiteMix();
+
+    for (const std::string &Name : Names) {
+        if (linearRoles(Name) != ota::lookupCalleeRoles(Name)) {
+            std::fprintf(stderr, "role mismatch for %s\n", Name.c_str());
+            return 1;
+        }
+    }
+
+    uint32_t Sink = 0;
+    double Linear = nsPerCallSite(Names, Iterations, linearRoles, Sink);
+    double Hashed = nsPerCallSite(Names, Iterations, ota::lookupCalleeRoles, Sink);
+
+    std::printf("call sites per run : %zu\n", Names.size());
+    std::printf("iterations         : %u\n", Iterations);
+    std::printf("linear name lists  : %.2f ns/call site\n", Linear);
+    std::printf("perfect-hash table : %.2f ns/call site\n", Hashed);
+    std::printf("(checksum %u)\n", Sink);
+    return 0;
+}
@@ -0,0 +1,218 @@
+// Checks the OTA policy on a bitcode file without loading all of it. The
+// module is opened lazily and only the entry points and the functions they
+// call, directly or transitively, are materialized; everything else stays on
+// disk. A module whose symbol table shows no entry point and no install-role
+// function is accepted before any body is loaded. The checks themselves are
+// the traversal-module-pass of the plugin, linked in directly.
+//
+// Several inputs can be checked in one run. Every violation of every input is
+// reported, and the exit status is 1 if any input violates the policy.
+//
+// -remarks-output keeps the per-check remarks of the whole run in one file,
+// bitstream by default, including those of inputs that fail.
+
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "../OTAPolicy.h"
+
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::desc("<input bitcode or IR>..."),
+                                           cl::OneOrMore);
+
+static cl::opt<bool> ReportMaterialized(
+    "report-materialized",
+    cl::desc("Print how many function bodies were loaded out of how many were defined"));
+
+static cl::opt<bool> PrefilterOnly(
+    "prefilter-only",
+    cl::desc("Only run the symbol-table prefilter and print 'accept' (the module passes "
+             "without analysis) or 'check' (it needs the full check), one line per input"));
+
+static cl::opt<std::string> RemarksFilename(
+    "remarks-output", cl::value_desc("filename"),
+    cl::desc("Write a remark for every check, passed or failed, to this file"));
+
+static cl::opt<std::string> RemarksFormat("remarks-format", cl::value_desc("format"),
+                                          cl::desc("Remark format: bitstream or yaml"),
+                                          cl::init("bitstream"));
+
+static int fail(const Twine &Message) {
+    WithColor::error(errs(), "ota-check") << Message << "\n";
+    return 1;
+}
+
+// Prints policy violations and counts them instead of letting the first one
+// end the process; other diagnostics get the default handling.
+struct ViolationCounter : public DiagnosticHandler {
+    unsigned Violating = 0;
+
+    bool handleDiagnostics(const DiagnosticInfo &DI) override {
+        if (!isa<ota::PolicyViolationDiagnostic>(DI)) {
+            return false;
+        }
+        DiagnosticPrinterRawOStream DP(WithColor::error(errs(), "ota-check"));
+        DI.print(DP);
+        errs() << "\n";
+        ++Violating;
+        return true;
+    }
+};
+
+// Loads the bodies of the entry points and of every function they reach
+// through direct calls. Returns the number of bodies loaded.
+static Expected<unsigned> materializeEntryClosure(Module &M) {
+    Expected<ota::AnnotatedRoles> Annotations = ota::AnnotatedRoles::parse(M);
+    if (!Annotations) {
+        return Annotations.takeError();
+    }
+
+    std::vector<Function *> Worklist;
+    SmallPtrSet<Function *, 32> Seen;
+    for (Function &F : M) {
+        if (ota::isEntryPoint(F, *Annotations) && Seen.insert(&F).second) {
+            Worklist.push_back(&F);
+        }
+    }
+
+    unsigned Loaded = 0;
+    while (!Worklist.empty()) {
+        Function *F = Worklist.back();
+        Worklist.pop_back();
+
+        if (F->isMaterializable()) {
+            if (Error Err = F->materialize()) {
+                return Err;
+            }
+            ++Loaded;
+        }
+
+        for (Instruction &I : instructions(*F)) {
+            auto *CB = dyn_cast<CallBase>(&I);
+            Function *Callee = CB ? CB->getCalledFunction() : nullptr;
+            if (Callee && Seen.insert(Callee).second) {
+                Worklist.push_back(Callee);
+            }
+        }
+    }
+
+    // Whatever was not reached cannot affect the entries' verdict; turning it
+    // into declarations keeps anything downstream from loading it after all.
+    for (Function &F : M) {
+        if (F.isMaterializable()) {
+            F.deleteBody();
+        }
+    }
+    return Loaded;
+}
+
+// Checks one input. Returns nonzero if it could not be checked; violations
+// are counted by the context's handler.
+static int checkFile(StringRef Filename, LLVMContext &Context) {
+    SMDiagnostic Diag;
+    std::unique_ptr<Module> M = getLazyIRFileModule(Filename, Diag, Context);
+    if (!M) {
+        Diag.print("ota-check", errs());
+        return 1;
+    }
+
+    bool Relevant = ota::isPolicyRelevant(*M);
+    if (PrefilterOnly) {
+        outs() << (Relevant ? "check" : "accept") << "\n";
+        return 0;
+    }
+    if (!Relevant) {
+        return 0;
+    }
+
+    unsigned Defined = 0;
+    for (Function &F : *M) {
+        Defined += !F.isDeclaration();
+    }
+
+    Expected<unsigned> Loaded = materializeEntryClosure(*M);
+    if (!Loaded) {
+        return fail(Filename + ": " + toString(Loaded.takeError()));
+    }
+    if (ReportMaterialized) {
+        errs() << "[OTA Security Pass] materialized " << *Loaded << " of " << Defined
+               << " function bodies\n";
+    }
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PassBuilder PB;
+    llvmGetPassPluginInfo().RegisterPassBuilderCallbacks(PB);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    if (Error Err = PB.parsePassPipeline(MPM, "traversal-module-pass")) {
+        return fail(toString(std::move(Err)));
+    }
+
+    MPM.run(*M, MAM);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "OTA security policy checker\n");
+
+    LLVMContext Context;
+    auto Handler = std::make_unique<ViolationCounter>();
+    ViolationCounter *Counter = Handler.get();
+    Context.setDiagnosticHandler(std::move(Handler));
+
+    Expected<std::unique_ptr<ToolOutputFile>> RemarksFile = setupLLVMOptimizationRemarks(
+        Context, RemarksFilename, "ota-policy", RemarksFormat, /*RemarksWithHotness=*/false);
+    if (!RemarksFile) {
+        return fail(toString(RemarksFile.takeError()));
+    }
+
+    int Status = 0;
+    for (const std::string &Filename : InputFilenames) {
+        if (checkFile(Filename, Context) != 0) {
+            Status = 1;
+        }
+    }
+    if (*RemarksFile) {
+        (*RemarksFile)->keep();
+    }
+    // A release build of LLVM has -stats but cannot print it; the plugin's
+    // counters are always kept, so print them here.
+    if (AreStatisticsEnabled()) {
+        PrintStatisticsJSON(errs());
+    }
+    return Counter->Violating != 0 ? 1 : Status;
+}
@@ -2,12 +2,12 @@
 set -euo pipefail
 
 CLANG_EXE="clang"
-OPT_EXE="opt"
+OPT_LEVEL="2"
 TESTS_DIR="tests"
 PLUGIN_PATH=""
 
 usage() {
-  echo "Usage: scripts/run_policy_matrix.sh [--clang clang] [--opt opt] [--tests-dir tests] [--plugin /path/to/libTraversalPass.so]"
+  echo "Usage: scripts/run_policy_matrix.sh [--clang clang] [--opt-level 0|1|2|3|s|z] [--tests-dir tests] [--plugin /path/to/libTraversalPass.so]"
 }
 
 resolve_plugin_path() {
@@ -38,8 +38,8 @@ while [[ $# -gt 0 ]]; do
       CLANG_EXE="$2"
       shift 2
       ;;
-    --opt)
-      OPT_EXE="$2"
+    --opt-level)
+      OPT_LEVEL="$2"
       shift 2
       ;;
     --tests-dir)
@@ -81,12 +81,15 @@ fi
 echo "Using plugin: $PLUGIN_RESOLVED"
 echo
 
+# The check runs inside clang's own pipeline, on the IR being optimized.
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
 failures=0
 total=0
 
 for cfile in "${TEST_FILES[@]}"; do
   base="$(basename "$cfile" .c)"
-  llfile="$TESTS_DIR/$base.ll"
   expected="skip"
 
   if [[ "$base" == secure* ]]; then
@@ -102,18 +105,18 @@ for cfile in "${TEST_FILES[@]}"; do
 
   total=$((total + 1))
 
-  if ! "$CLANG_EXE" -S -emit-llvm -Xclang -disable-O0-optnone "$cfile" -o "$llfile" >/dev/null 2>&1; then
+  if output="$("$CLANG_EXE" -O"$OPT_LEVEL" -c \
+      -fpass-plugin="$PLUGIN_RESOLVED" -Xclang -load -Xclang "$PLUGIN_RESOLVED" -mllvm -ota-pipeline-check \
+      "$cfile" -o "$WORK_DIR/$base.o" 2>&1)"; then
+    actual="pass"
+  elif [[ "$output" == *"[OTA Security Pass]"* ]]; then
+    actual="fail"
+  else
     echo "[FAIL] $(basename "$cfile"): clang failed"
     failures=$((failures + 1))
     continue
   fi
 
-  if "$OPT_EXE" -load-pass-plugin "$PLUGIN_RESOLVED" -passes=traversal-pass -disable-output "$llfile" >/dev/null 2>&1; then
-    actual="pass"
-  else
-    actual="fail"
-  fi
-
   if [[ "$actual" == "$expected" ]]; then
     echo "[OK]   $(basename "$cfile"): expected $expected, got $actual"
   else
@@ -0,0 +1,49 @@
+#include <stdint.h>
+#include <string.h>
+
+#define OTA_ENTRY __attribute__((annotate("ota_entry")))
+#define OTA_VERIFY __attribute__((annotate("ota_verify")))
+#define OTA_INSTALL __attribute__((annotate("ota_install")))
+
+typedef struct {
+    int version;
+    char source_url[128];
+    uint8_t image[1024];
+    uint32_t image_size;
+} FirmwarePackage;
+
+int current_version = 5;
+
+OTA_VERIFY int checkVendorSig(FirmwarePackage *pkg) {
+    return pkg->image_size > 0;
+}
+
+int sourceTrusted(FirmwarePackage *pkg) {
+    return strncmp(pkg->source_url, "https://github.com/", strlen("https://github.com/")) == 0;
+}
+
+OTA_INSTALL void flashImage(FirmwarePackage *pkg) {
+    (void)pkg;
+}
+
+OTA_ENTRY int handleUpdate(FirmwarePackage *pkg) {
+    if (!sourceTrusted(pkg)) {
+        return -1;
+    }
+
+    if (pkg->version > current_version) {
+        flashImage(pkg);
+        return 0;
+    }
+
+    return -1;
+}
+
+int main(void) {
+    FirmwarePackage pkg = {
+        .version = 7,
+        .source_url = "https://github.com/release/fw-v7.bin",
+        .image_size = 1024
+    };
+    return handleUpdate(&pkg);
+}
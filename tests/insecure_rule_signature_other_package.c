@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    int version;
+    char source_url[128];
+    uint8_t payload[1024];
+} FirmwarePackage;
+
+typedef struct {
+    FirmwarePackage *pkg;
+} UpdateContext;
+
+int current_version = 11;
+
+int verifySignature(FirmwarePackage *pkg) {
+    (void)pkg;
+    return 1;
+}
+
+int sourceTrusted(FirmwarePackage *pkg) {
+    return strncmp(pkg->source_url, "https://github.com/", strlen("https://github.com/")) == 0;
+}
+
+void install(FirmwarePackage *pkg) {
+    (void)pkg;
+}
+
+int updateFirmware(FirmwarePackage *pkg, FirmwarePackage *staged) {
+    UpdateContext ctx;
+    ctx.pkg = pkg;
+
+    if (!verifySignature(ctx.pkg)) {
+        return -1;
+    }
+
+    if (!sourceTrusted(staged)) {
+        return -1;
+    }
+
+    if (staged->version <= current_version) {
+        return -1;
+    }
+
+    // Only pkg was verified, but the staged package is installed.
+    install(staged);
+    return 0;
+}
+
+int main(void) {
+    FirmwarePackage pkg = {
+        .version = 12,
+        .source_url = "https://github.com/other-package/fw-v12.bin"
+    };
+    FirmwarePackage staged = {
+        .version = 12,
+        .source_url = "https://github.com/other-package/fw-v12-unsigned.bin"
+    };
+    return updateFirmware(&pkg, &staged);
+}
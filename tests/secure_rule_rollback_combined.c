@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    int version;
+    char source_url[128];
+    uint8_t payload[1024];
+    int force_update;
+} FirmwarePackage;
+
+int current_version = 11;
+
+int verifySignature(FirmwarePackage *pkg) {
+    (void)pkg;
+    return 1;
+}
+
+int sourceTrusted(FirmwarePackage *pkg) {
+    return strncmp(pkg->source_url, "https://github.com/", strlen("https://github.com/")) == 0;
+}
+
+void install(FirmwarePackage *pkg) {
+    (void)pkg;
+}
+
+int updateFirmware(FirmwarePackage *pkg) {
+    if (verifySignature(pkg) && sourceTrusted(pkg) && pkg->version > current_version) {
+        install(pkg);
+        return 0;
+    }
+
+    return -1;
+}
+
+int main(void) {
+    FirmwarePackage pkg = {
+        .version = 12,
+        .source_url = "https://github.com/rollback-combined/fw-v12.bin"
+    };
+    return updateFirmware(&pkg);
+}
@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    int version;
+    char source_url[128];
+    uint8_t payload[1024];
+} FirmwarePackage;
+
+typedef struct {
+    FirmwarePackage *pkg;
+} UpdateContext;
+
+int current_version = 11;
+
+int verifySignature(FirmwarePackage *pkg) {
+    (void)pkg;
+    return 1;
+}
+
+int sourceTrusted(FirmwarePackage *pkg) {
+    return strncmp(pkg->source_url, "https://github.com/", strlen("https://github.com/")) == 0;
+}
+
+void install(FirmwarePackage *pkg) {
+    (void)pkg;
+}
+
+int updateFirmware(FirmwarePackage *pkg) {
+    UpdateContext ctx;
+    ctx.pkg = pkg;
+
+    // The package verified is the one installed, copied through a struct
+    // field and a local.
+    FirmwarePackage *candidate = ctx.pkg;
+    if (!verifySignature(candidate)) {
+        return -1;
+    }
+
+    if (!sourceTrusted(ctx.pkg)) {
+        return -1;
+    }
+
+    if (pkg->version <= current_version) {
+        return -1;
+    }
+
+    install(pkg);
+    return 0;
+}
+
+int main(void) {
+    FirmwarePackage pkg = {
+        .version = 12,
+        .source_url = "https://github.com/same-package/fw-v12.bin"
+    };
+    return updateFirmware(&pkg);
+}
@@ -1,5 +1,6 @@
 from __future__ import annotations
 
+import json
 import os
 import re
 import subprocess
@@ -17,43 +18,47 @@ SECURE_CLANG = REPO_ROOT / "secure-clang"
 app = Flask(__name__)
 
 
-def _find_line_hints(source_code: str, messages: list[str]) -> list[dict[str, Any]]:
-    lines = source_code.splitlines()
-    hints: list[dict[str, Any]] = []
+def _read_sarif_results(sarif_path: Path) -> tuple[list[str], list[dict[str, Any]]]:
+    # secure-clang --sarif writes one result per violation, with the rule ID
+    # and the source position of the offending call.
+    if not sarif_path.is_file():
+        return [], []
 
-    # Map common violation keywords to line-level hints in source.
-    keyword_map = {
-        "printf": "Sensitive logging API",
-        "puts": "Sensitive logging API",
-        "fprintf": "Sensitive logging API",
-        "perror": "Sensitive logging API",
-        "rand": "Weak entropy API",
-        "srand": "Weak entropy API",
-        "sha1": "Weak crypto API",
-        "md5": "Weak crypto API",
-        "install": "Install path check",
-        "verifysignature": "Signature dominance check",
-        "sourcetrusted": "Trusted source check",
-        "validatesource": "Trusted source check",
-    }
-
-    lower_msgs = "\n".join(messages).lower()
-
-    for idx, line in enumerate(lines, start=1):
-        normalized = line.lower()
-        for key, label in keyword_map.items():
-            if key in normalized and key in lower_msgs:
-                hints.append(
-                    {
-                        "line": idx,
-                        "kind": "warning",
-                        "label": label,
-                        "source": line.strip(),
-                    }
-                )
-                break
+    try:
+        log = json.loads(sarif_path.read_text(encoding="utf-8"))
+    except (OSError, ValueError):
+        return [], []
 
-    return hints
+    violations: list[str] = []
+    hints: list[dict[str, Any]] = []
+    for run in log.get("runs", []):
+        for result in run.get("results", []):
+            rule = result.get("ruleId", "")
+            text = result.get("message", {}).get("text", "")
+            steps = [
+                step.get("location", {}).get("message", {}).get("text", "")
+                for flow in result.get("codeFlows", [])
+                for thread in flow.get("threadFlows", [])
+                for step in thread.get("locations", [])
+            ]
+            witness = f" (path: {' -> '.join(steps)})" if steps else ""
+            violations.append(f"[{rule}] {text}{witness}")
+
+            for location in result.get("locations", []):
+                region = location.get("physicalLocation", {}).get("region", {})
+                if "startLine" not in region:
+                    continue
+                hint: dict[str, Any] = {
+                    "line": region["startLine"],
+                    "kind": "error",
+                    "label": f"{rule}: {text}",
+                    "rule": rule,
+                }
+                if "startColumn" in region:
+                    hint["column"] = region["startColumn"]
+                hints.append(hint)
+
+    return violations, hints
 
 
 def _extract_clang_syntax_hints(raw_output: str) -> list[dict[str, Any]]:
@@ -125,9 +130,10 @@ def run_secure_compile(source_code: str, filename: str) -> dict[str, Any]:
         tmp_path = Path(tmp)
         src_path = tmp_path / safe_name
         out_path = tmp_path / "demo.out"
+        sarif_path = tmp_path / "policy.sarif"
         src_path.write_text(source_code, encoding="utf-8")
 
-        cmd = [str(SECURE_CLANG), str(src_path), "-o", str(out_path)]
+        cmd = [str(SECURE_CLANG), "--sarif", str(sarif_path), str(src_path), "-o", str(out_path)]
 
         proc = subprocess.run(
             cmd,
@@ -139,13 +145,7 @@ def run_secure_compile(source_code: str, filename: str) -> dict[str, Any]:
 
         raw_output = (proc.stdout or "") + ("\n" if proc.stdout and proc.stderr else "") + (proc.stderr or "")
 
-        violations = [
-            line.strip()[2:].strip()
-            for line in raw_output.splitlines()
-            if line.strip().startswith("-")
-        ]
-
-        hints = _find_line_hints(source_code, violations)
+        violations, hints = _read_sarif_results(sarif_path)
         hints.extend(_extract_clang_syntax_hints(raw_output))
         energy = _extract_energy_metrics(raw_output)
 